@@ -7,104 +7,2025 @@
 
 #pragma once
 #include "StringHelper.h"
+#include "TextIO.h"
+#include "Utils.h"
+#include "PerThreadShards.h"
 #include <chrono>
 #include <map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <iostream>
+#include <type_traits>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <unordered_map>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BM_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+#ifdef __linux__
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 
 #define BM_FUNC(f) [&](){ f; }, #f
+#define BM_CONCAT_IMPL(a, b) a##b
+#define BM_CONCAT(a, b) BM_CONCAT_IMPL(a, b)
+// Times the rest of the enclosing scope as a nested zone. See benchmark::ScopeZone.
+#define BM_SCOPE(name) benchmark::ScopeZone BM_CONCAT(bm_scope_zone_, __LINE__)(name)
+// Interns name once per call site (function-local static) and yields a benchmark::TagId.
+#define BM_TAG(name) ([]() { static const benchmark::TagId bm_tag_id = benchmark::tag_registry().intern(name); return bm_tag_id; }())
 
 namespace benchmark
 {
   
+  // //////////////////
+  //  Clock policies  //
+  // //////////////////
+  
+  // A clock policy provides now_ns(), returning a monotonic time stamp in integer nanoseconds.
+  // Durations are accumulated as integer nanoseconds and only converted to ms when reported.
+  
+  struct SteadyClock
+  {
+    static int64_t now_ns()
+    {
+      auto t = std::chrono::steady_clock::now().time_since_epoch();
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+    }
+  };
+  
+  // clock_gettime(CLOCK_MONOTONIC_RAW) on Linux: not slewed by NTP.
+  // Falls back to SteadyClock on other platforms.
+  struct MonotonicRawClock
+  {
+    static int64_t now_ns()
+    {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_RAW)
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#else
+      return SteadyClock::now_ns();
+#endif
+    }
+  };
+  
+  namespace detail
+  {
+  
+    // Conversion from TSC ticks to ns, calibrated once against steady_clock.
+    struct TscCalibration
+    {
+      uint64_t base_ticks = 0;
+      double ns_per_tick = 1.0;
+    };
+    
+#ifdef BM_HAS_TSC
+    const TscCalibration& get_tsc_calibration()
+    {
+      static const TscCalibration calib = []()
+      {
+        TscCalibration c;
+        auto ns0 = SteadyClock::now_ns();
+        auto ticks0 = __rdtsc();
+        // Busy-wait rather than sleep so that the core does not change frequency state.
+        while (SteadyClock::now_ns() - ns0 < 20'000'000)
+          ;
+        auto ns1 = SteadyClock::now_ns();
+        auto ticks1 = __rdtsc();
+        c.base_ticks = ticks1;
+        if (ticks1 > ticks0)
+          c.ns_per_tick = static_cast<double>(ns1 - ns0) / static_cast<double>(ticks1 - ticks0);
+        return c;
+      }();
+      return calib;
+    }
+    
+    inline int64_t tsc_ticks_to_ns(uint64_t ticks)
+    {
+      const auto& calib = get_tsc_calibration();
+      auto rel_ticks = static_cast<int64_t>(ticks - calib.base_ticks);
+      return static_cast<int64_t>(static_cast<double>(rel_ticks) * calib.ns_per_tick);
+    }
+#endif
+  
+  }
+  
+  // Time stamp counter (rdtsc), assumes an invariant TSC. Lowest overhead, but not serializing:
+  //   out-of-order execution may move the read slightly.
+  // Falls back to SteadyClock on non-x86 targets.
+  struct TscClock
+  {
+    static int64_t now_ns()
+    {
+#ifdef BM_HAS_TSC
+      return detail::tsc_ticks_to_ns(__rdtsc());
+#else
+      return SteadyClock::now_ns();
+#endif
+    }
+  };
+  
+  // Like TscClock but uses rdtscp, which waits for all prior instructions to retire.
+  struct TscpClock
+  {
+    static int64_t now_ns()
+    {
+#ifdef BM_HAS_TSC
+      unsigned int aux = 0;
+      return detail::tsc_ticks_to_ns(__rdtscp(&aux));
+#else
+      return SteadyClock::now_ns();
+#endif
+    }
+  };
+  
+#ifndef BM_DEFAULT_CLOCK
+#define BM_DEFAULT_CLOCK SteadyClock
+#endif
+  using DefaultClock = BM_DEFAULT_CLOCK;
+  
+  inline double ns_to_ms(int64_t ns)
+  {
+    return static_cast<double>(ns) * 1e-6;
+  }
+  
+  // //////////////////
+  
+  template<typename Clock = DefaultClock, typename Lambda>
+  int64_t calc_time_ns(Lambda&& func)
+  {
+    auto start_time = Clock::now_ns();
+    func();
+    auto end_time = Clock::now_ns();
+    return end_time - start_time;
+  }
+  
   template<typename Lambda>
   float calc_time_ms(Lambda&& func)
   {
-    auto start_time = std::chrono::steady_clock::now();
-    func();
-    auto end_time = std::chrono::steady_clock::now();
+    return static_cast<float>(ns_to_ms(calc_time_ns(func)));
+  }
+  
+  // One tic/toc stopwatch per thread.
+  thread_local int64_t benchmark_tictoc_time_ns = 0;
+  
+  void tic()
+  {
+    benchmark_tictoc_time_ns = DefaultClock::now_ns();
+  }
+  
+  int64_t toc_ns()
+  {
+    return DefaultClock::now_ns() - benchmark_tictoc_time_ns;
+  }
+  
+  float toc()
+  {
+    return static_cast<float>(ns_to_ms(toc_ns()));
+  }
+  
+  // Keeps the compiler from eliding the computation of val.
+  template<typename T>
+  inline void do_not_optimize(const T& val)
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(val) : "memory");
+#else
+    static const void* volatile sink = nullptr;
+    sink = &val;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+  }
+  
+  // Forces pending writes to memory to be treated as observable.
+  inline void clobber_memory()
+  {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : : "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+  }
+  
+  // Calls func and sinks its return value (if any).
+  template<typename Lambda>
+  inline void invoke_sunk(Lambda& func)
+  {
+    if constexpr (std::is_void_v<std::invoke_result_t<Lambda&>>)
+      func();
+    else
+      do_not_optimize(func());
+  }
+  
+  struct RunConfig
+  {
+    int num_warmup = 3;
+    int num_repetitions = 30;
+    // Iterations per repetition are doubled until one repetition takes at least this long.
+    float min_repetition_time_ms = 2.f;
+    int max_iterations = 1 << 30;
+    // If > 0, skips calibration and uses this many iterations per repetition.
+    int num_iterations = 0;
+  };
+  
+  // All times are per iteration, in nanoseconds.
+  struct Stats
+  {
+    int num_iterations = 0;
+    int num_repetitions = 0;
+    double min_ns = 0.0;
+    double median_ns = 0.0;
+    double mean_ns = 0.0;
+    double p95_ns = 0.0;
+    double p99_ns = 0.0;
+    double max_ns = 0.0;
+    double stddev_ns = 0.0;
+  };
+  
+  // Linearly interpolated percentile p in [0, 100] of an ascending sequence.
+  double percentile_sorted(const std::vector<double>& sorted, double p)
+  {
+    if (sorted.empty())
+      return 0.0;
+    auto pos = p / 100.0 * static_cast<double>(sorted.size() - 1);
+    auto idx = static_cast<size_t>(pos);
+    if (idx + 1 >= sorted.size())
+      return sorted.back();
+    auto t = pos - static_cast<double>(idx);
+    return sorted[idx] * (1.0 - t) + sorted[idx + 1] * t;
+  }
+  
+  Stats calc_stats(std::vector<double> samples_ns, int num_iterations = 1)
+  {
+    Stats stats;
+    stats.num_iterations = num_iterations;
+    stats.num_repetitions = static_cast<int>(samples_ns.size());
+    if (samples_ns.empty())
+      return stats;
+    std::sort(samples_ns.begin(), samples_ns.end());
+    auto N = static_cast<double>(samples_ns.size());
+    stats.min_ns = samples_ns.front();
+    stats.max_ns = samples_ns.back();
+    stats.median_ns = percentile_sorted(samples_ns, 50.0);
+    stats.p95_ns = percentile_sorted(samples_ns, 95.0);
+    stats.p99_ns = percentile_sorted(samples_ns, 99.0);
+    double sum = 0.0;
+    for (auto s : samples_ns)
+      sum += s;
+    stats.mean_ns = sum / N;
+    double sum_sq = 0.0;
+    for (auto s : samples_ns)
+      sum_sq += math::sq(s - stats.mean_ns);
+    stats.stddev_ns = samples_ns.size() > 1 ? std::sqrt(sum_sq / (N - 1.0)) : 0.0;
+    return stats;
+  }
+  
+  // Runs func num_iterations times in a row and returns the total time in ns.
+  template<typename Clock = DefaultClock, typename Lambda>
+  int64_t time_batch_ns(Lambda& func, int num_iterations)
+  {
+    auto start_time = Clock::now_ns();
+    for (int i = 0; i < num_iterations; ++i)
+    {
+      invoke_sunk(func);
+      clobber_memory();
+    }
+    return Clock::now_ns() - start_time;
+  }
+  
+  // Finds the number of iterations needed for one repetition to take at least min_time_ms.
+  template<typename Clock = DefaultClock, typename Lambda>
+  int calibrate_iterations(Lambda& func, float min_time_ms, int max_iterations)
+  {
+    auto min_time_ns = static_cast<double>(min_time_ms) * 1e6;
+    int num_iterations = 1;
+    while (num_iterations < max_iterations)
+    {
+      auto batch_ns = static_cast<double>(time_batch_ns<Clock>(func, num_iterations));
+      if (batch_ns >= min_time_ns)
+        break;
+      // Jump close to the target directly when the batch is long enough to be trusted.
+      auto factor = batch_ns > min_time_ns * 0.01 ? 1.2 * min_time_ns / batch_ns : 10.0;
+      auto next = static_cast<double>(num_iterations) * std::clamp(factor, 2.0, 10.0);
+      num_iterations = static_cast<int>(std::min(next, static_cast<double>(max_iterations)));
+    }
+    return num_iterations;
+  }
+  
+  // Auto-calibrated, repeated measurement of func.
+  template<typename Clock = DefaultClock, typename Lambda>
+  Stats measure(Lambda&& func, const RunConfig& cfg = {})
+  {
+    // One untimed call so that one-off lazy initialization does not skew the calibration.
+    invoke_sunk(func);
+    auto num_iterations = cfg.num_iterations > 0 ? cfg.num_iterations :
+      calibrate_iterations<Clock>(func, cfg.min_repetition_time_ms, cfg.max_iterations);
+    for (int w = 0; w < cfg.num_warmup; ++w)
+      time_batch_ns<Clock>(func, num_iterations);
+    std::vector<double> samples_ns;
+    samples_ns.reserve(std::max(cfg.num_repetitions, 1));
+    for (int r = 0; r < std::max(cfg.num_repetitions, 1); ++r)
+      samples_ns.emplace_back(static_cast<double>(time_batch_ns<Clock>(func, num_iterations)) / num_iterations);
+    return calc_stats(std::move(samples_ns), num_iterations);
+  }
+  
+  std::string format_ns(double ns)
+  {
+    char buf[32];
+    if (ns < 1e3)
+      std::snprintf(buf, sizeof(buf), "%.2f ns", ns);
+    else if (ns < 1e6)
+      std::snprintf(buf, sizeof(buf), "%.2f us", ns * 1e-3);
+    else
+      std::snprintf(buf, sizeof(buf), "%.2f ms", ns * 1e-6);
+    return buf;
+  }
+  
+  // ///////////////////
+  //  Interned tags    //
+  // ///////////////////
+  
+  // Small integer id of an interned tag. Use BM_TAG("name") to get one.
+  struct TagId
+  {
+    uint32_t id = 0;
+  };
+  
+  static constexpr uint32_t c_max_tags = 1024;
+  
+  // Assigns dense ids to tag names. Only used when a tag is first interned,
+  //   never on the start()/stop() hot path.
+  class TagRegistry
+  {
+    mutable std::mutex names_mutex;
+    std::vector<std::string> names;
+    std::map<std::string, uint32_t> ids;
+    
+  public:
+    // When all ids are used up, further tags share the last id.
+    TagId intern(const std::string& name)
+    {
+      std::lock_guard<std::mutex> lock(names_mutex);
+      auto it = ids.find(name);
+      if (it != ids.end())
+        return { it->second };
+      if (names.size() + 1 >= c_max_tags)
+      {
+        if (names.size() + 1 == c_max_tags)
+          names.emplace_back("(tag overflow)");
+        return { c_max_tags - 1 };
+      }
+      auto id = static_cast<uint32_t>(names.size());
+      names.emplace_back(name);
+      ids[name] = id;
+      return { id };
+    }
+    
+    std::string get_name(TagId tag) const
+    {
+      std::lock_guard<std::mutex> lock(names_mutex);
+      return tag.id < names.size() ? names[tag.id] : std::string {};
+    }
+    
+    uint32_t size() const
+    {
+      std::lock_guard<std::mutex> lock(names_mutex);
+      return static_cast<uint32_t>(names.size());
+    }
+  };
+  
+  TagRegistry& tag_registry()
+  {
+    static TagRegistry registry;
+    return registry;
+  }
+  
+  // ////////////////////////////////
+  //  Hardware performance counters //
+  // ////////////////////////////////
+  
+  struct HwCounters
+  {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t l1d_misses = 0;
+    uint64_t llc_misses = 0;
+    uint64_t branch_misses = 0;
+    
+    HwCounters operator-(const HwCounters& other) const
+    {
+      return { cycles - other.cycles, instructions - other.instructions,
+        l1d_misses - other.l1d_misses, llc_misses - other.llc_misses,
+        branch_misses - other.branch_misses };
+    }
+    
+    HwCounters& operator+=(const HwCounters& other)
+    {
+      cycles += other.cycles;
+      instructions += other.instructions;
+      l1d_misses += other.l1d_misses;
+      llc_misses += other.llc_misses;
+      branch_misses += other.branch_misses;
+      return *this;
+    }
+    
+    // Instructions per cycle.
+    double ipc() const
+    {
+      return cycles > 0 ? static_cast<double>(instructions) / static_cast<double>(cycles) : 0.0;
+    }
+  };
+  
+  // Counter group for the calling thread (user space only) via perf_event_open on Linux.
+  // If the kernel refuses (perf_event_paranoid, containers, no PMU in VMs) the group is
+  //   simply unavailable and reads return zeros. Counters the CPU lacks read as zero.
+  class PerfCounterGroup
+  {
+    static constexpr int c_num_counters = 5;
+    int fds[c_num_counters] = { -1, -1, -1, -1, -1 };
+    uint64_t ids[c_num_counters] = {};
+    
+#ifdef __linux__
+    static int open_counter(uint32_t type, uint64_t config, int group_fd)
+    {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = group_fd == -1 ? 1 : 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+      return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+#endif
+    
+  public:
+    PerfCounterGroup()
+    {
+#ifdef __linux__
+      const std::pair<uint32_t, uint64_t> events[c_num_counters]
+      {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+          | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+      };
+      // The cycle counter leads the group. Without it there is no group at all.
+      for (int c_idx = 0; c_idx < c_num_counters; ++c_idx)
+      {
+        fds[c_idx] = open_counter(events[c_idx].first, events[c_idx].second, fds[0]);
+        if (fds[c_idx] == -1)
+        {
+          if (c_idx == 0)
+            return;
+          continue;
+        }
+        ioctl(fds[c_idx], PERF_EVENT_IOC_ID, &ids[c_idx]);
+      }
+      ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    
+    ~PerfCounterGroup()
+    {
+#ifdef __linux__
+      for (int fd : fds)
+        if (fd != -1)
+          close(fd);
+#endif
+    }
+    
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+    
+    bool is_available() const { return fds[0] != -1; }
+    
+    HwCounters read_counters() const
+    {
+      HwCounters hw;
+#ifdef __linux__
+      if (!is_available())
+        return hw;
+      // { nr, { value, id } x nr }
+      uint64_t buf[1 + 2*c_num_counters] = {};
+      if (::read(fds[0], buf, sizeof(buf)) <= 0)
+        return hw;
+      uint64_t* dst[c_num_counters] = { &hw.cycles, &hw.instructions, &hw.l1d_misses, &hw.llc_misses, &hw.branch_misses };
+      auto nr = std::min<uint64_t>(buf[0], c_num_counters);
+      for (uint64_t v_idx = 0; v_idx < nr; ++v_idx)
+        for (int c_idx = 0; c_idx < c_num_counters; ++c_idx)
+          if (fds[c_idx] != -1 && ids[c_idx] == buf[2 + 2*v_idx])
+            *dst[c_idx] = buf[1 + 2*v_idx];
+#endif
+      return hw;
+    }
+  };
+  
+  // Counter group of the calling thread, opened on first use.
+  PerfCounterGroup& local_perf_counters()
+  {
+    thread_local PerfCounterGroup group;
+    return group;
+  }
+  
+  // ///////////////////////
+  //  Allocation tracking  //
+  // ///////////////////////
+  
+  struct AllocCounters
+  {
+    uint64_t num_allocs = 0;
+    uint64_t num_bytes = 0;
+    
+    AllocCounters operator-(const AllocCounters& other) const
+    {
+      return { num_allocs - other.num_allocs, num_bytes - other.num_bytes };
+    }
+    
+    AllocCounters& operator+=(const AllocCounters& other)
+    {
+      num_allocs += other.num_allocs;
+      num_bytes += other.num_bytes;
+      return *this;
+    }
+  };
+  
+  namespace detail
+  {
+    thread_local AllocCounters thread_alloc_counters;
+  }
+  
+  // Heap allocations made by the calling thread so far. Only counts anything when the
+  //   global operator new/delete hooks are compiled in, i.e. when BM_TRACK_ALLOCATIONS
+  //   is defined before Benchmark.h is included (in exactly one translation unit).
+  inline AllocCounters get_alloc_counters()
+  {
+    return detail::thread_alloc_counters;
+  }
+  
+#ifdef BM_TRACK_ALLOCATIONS
+  static constexpr bool c_alloc_hooks_compiled = true;
+#else
+  static constexpr bool c_alloc_hooks_compiled = false;
+#endif
+  
+  struct Timer
+  {
+    int64_t total_ns = 0;
+    int64_t num_calls = 0;
+    // Only accumulated when hardware counters / allocation tracking are enabled on the Benchmark.
+    HwCounters hw;
+    AllocCounters alloc;
+    
+    void add(int64_t dt_ns)
+    {
+      total_ns += dt_ns;
+      num_calls++;
+    }
+    
+    void merge(const Timer& other)
+    {
+      total_ns += other.total_ns;
+      num_calls += other.num_calls;
+      hw += other.hw;
+      alloc += other.alloc;
+    }
+  };
+  
+  // ///////////////////
+  //  Result files     //
+  // ///////////////////
+  
+  // One row of machine-readable output. Kind is "timer" for start()/stop()/reg() timers
+  //   and "stats" for run() measurements. Fields that do not apply to a kind are 0.
+  struct Result
+  {
+    std::string tag;
+    std::string kind;
+    int64_t num_calls = 0;
+    double total_ms = 0.0;
+    double mean_ns = 0.0;
+    double min_ns = 0.0;
+    double median_ns = 0.0;
+    double p95_ns = 0.0;
+    double p99_ns = 0.0;
+    double stddev_ns = 0.0;
+    int iterations = 0;
+    int repetitions = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t l1d_misses = 0;
+    uint64_t llc_misses = 0;
+    uint64_t branch_misses = 0;
+    uint64_t num_allocs = 0;
+    uint64_t alloc_bytes = 0;
+    
+    // Figure of merit used when comparing against a baseline: the median time per
+    //   iteration for "stats" results and the mean time per call for "timer" results.
+    double metric_ns() const
+    {
+      return kind == "stats" ? median_ns : mean_ns;
+    }
+  };
+  
+  Result make_result(const std::string& tag, const Timer& timer)
+  {
+    Result res;
+    res.tag = tag;
+    res.kind = "timer";
+    res.num_calls = timer.num_calls;
+    res.total_ms = ns_to_ms(timer.total_ns);
+    res.mean_ns = timer.num_calls > 0 ? static_cast<double>(timer.total_ns) / timer.num_calls : 0.0;
+    res.cycles = timer.hw.cycles;
+    res.instructions = timer.hw.instructions;
+    res.l1d_misses = timer.hw.l1d_misses;
+    res.llc_misses = timer.hw.llc_misses;
+    res.branch_misses = timer.hw.branch_misses;
+    res.num_allocs = timer.alloc.num_allocs;
+    res.alloc_bytes = timer.alloc.num_bytes;
+    return res;
+  }
+  
+  Result make_result(const std::string& tag, const Stats& stats)
+  {
+    Result res;
+    res.tag = tag;
+    res.kind = "stats";
+    res.num_calls = static_cast<int64_t>(stats.num_iterations) * stats.num_repetitions;
+    res.total_ms = stats.mean_ns * static_cast<double>(res.num_calls) * 1e-6;
+    res.mean_ns = stats.mean_ns;
+    res.min_ns = stats.min_ns;
+    res.median_ns = stats.median_ns;
+    res.p95_ns = stats.p95_ns;
+    res.p99_ns = stats.p99_ns;
+    res.stddev_ns = stats.stddev_ns;
+    res.iterations = stats.num_iterations;
+    res.repetitions = stats.num_repetitions;
+    return res;
+  }
+  
+  namespace detail
+  {
+  
+    std::string format_double(double val)
+    {
+      char buf[32];
+      std::snprintf(buf, sizeof(buf), "%.6g", val);
+      return buf;
+    }
+    
+    // Control characters are written as \u00XX, since tags come straight from users.
+    std::string json_escape(const std::string& s)
+    {
+      std::string ret;
+      for (char c : s)
+      {
+        auto uc = static_cast<unsigned char>(c);
+        if (uc < 0x20)
+        {
+          char buf[8];
+          std::snprintf(buf, sizeof(buf), "\\u%04x", uc);
+          ret += buf;
+          continue;
+        }
+        if (c == '"' || c == '\\')
+          ret += '\\';
+        ret += c;
+      }
+      return ret;
+    }
+    
+    // JSON has no NaN or infinity, e.g. for the stats of zero-iteration or zero-time runs, so they become null.
+    std::string json_number(const std::string& val)
+    {
+      return std::isfinite(std::strtod(val.c_str(), nullptr)) ? val : "null";
+    }
+    
+    std::string csv_escape(const std::string& s)
+    {
+      if (s.find_first_of(",\"\n") == std::string::npos)
+        return s;
+      std::string ret = "\"";
+      for (char c : s)
+      {
+        if (c == '"')
+          ret += '"';
+        ret += c;
+      }
+      return ret + "\"";
+    }
+    
+    // Parses the flat "key": value pairs of a single-line JSON object, as written by to_json().
+    std::map<std::string, std::string> parse_flat_json_object(const std::string& line)
+    {
+      std::map<std::string, std::string> fields;
+      size_t pos = 0;
+      auto parse_string = [&line, &pos]()
+      {
+        std::string ret;
+        for (++pos; pos < line.size() && line[pos] != '"'; ++pos)
+        {
+          if (line[pos] == '\\' && pos + 5 < line.size() && line[pos + 1] == 'u')
+          {
+            ret += static_cast<char>(std::strtol(line.substr(pos + 2, 4).c_str(), nullptr, 16));
+            pos += 5;
+            continue;
+          }
+          if (line[pos] == '\\' && pos + 1 < line.size())
+            ++pos;
+          ret += line[pos];
+        }
+        ++pos;
+        return ret;
+      };
+      while ((pos = line.find('"', pos)) != std::string::npos)
+      {
+        auto key = parse_string();
+        pos = line.find(':', pos);
+        if (pos == std::string::npos)
+          break;
+        pos = line.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos)
+          break;
+        if (line[pos] == '"')
+          fields[key] = parse_string();
+        else
+        {
+          auto end = line.find_first_of(",}", pos);
+          fields[key] = str::trim_ret(line.substr(pos, end - pos));
+          pos = end;
+        }
+      }
+      return fields;
+    }
+    
+    std::vector<std::string> split_csv_line(const std::string& line)
+    {
+      std::vector<std::string> cells(1);
+      bool quoted = false;
+      for (size_t i = 0; i < line.size(); ++i)
+      {
+        char c = line[i];
+        if (quoted)
+        {
+          if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+            cells.back() += line[++i];
+          else if (c == '"')
+            quoted = false;
+          else
+            cells.back() += c;
+        }
+        else if (c == '"')
+          quoted = true;
+        else if (c == ',')
+          cells.emplace_back();
+        else
+          cells.back() += c;
+      }
+      return cells;
+    }
+    
+    static const std::vector<std::string> c_result_fields
+    {
+      "tag", "kind", "num_calls", "total_ms", "mean_ns", "min_ns", "median_ns",
+      "p95_ns", "p99_ns", "stddev_ns", "iterations", "repetitions",
+      "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+      "num_allocs", "alloc_bytes"
+    };
+    
+    std::vector<std::string> result_values(const Result& res)
+    {
+      return
+      {
+        res.tag, res.kind, std::to_string(res.num_calls), format_double(res.total_ms),
+        format_double(res.mean_ns), format_double(res.min_ns), format_double(res.median_ns),
+        format_double(res.p95_ns), format_double(res.p99_ns), format_double(res.stddev_ns),
+        std::to_string(res.iterations), std::to_string(res.repetitions),
+        std::to_string(res.cycles), std::to_string(res.instructions), std::to_string(res.l1d_misses),
+        std::to_string(res.llc_misses), std::to_string(res.branch_misses),
+        std::to_string(res.num_allocs), std::to_string(res.alloc_bytes)
+      };
+    }
+    
+    Result result_from_fields(const std::map<std::string, std::string>& fields)
+    {
+      auto get = [&fields](const std::string& key) -> std::string
+      {
+        auto it = fields.find(key);
+        return it != fields.end() ? it->second : std::string {};
+      };
+      // null is how to_json() writes NaN and infinity.
+      auto get_d = [&get](const std::string& key)
+      {
+        auto v = get(key);
+        if (v == "null")
+          return std::numeric_limits<double>::quiet_NaN();
+        return v.empty() ? 0.0 : std::stod(v);
+      };
+      Result res;
+      res.tag = get("tag");
+      res.kind = get("kind");
+      res.num_calls = static_cast<int64_t>(get_d("num_calls"));
+      res.total_ms = get_d("total_ms");
+      res.mean_ns = get_d("mean_ns");
+      res.min_ns = get_d("min_ns");
+      res.median_ns = get_d("median_ns");
+      res.p95_ns = get_d("p95_ns");
+      res.p99_ns = get_d("p99_ns");
+      res.stddev_ns = get_d("stddev_ns");
+      res.iterations = static_cast<int>(get_d("iterations"));
+      res.repetitions = static_cast<int>(get_d("repetitions"));
+      res.cycles = static_cast<uint64_t>(get_d("cycles"));
+      res.instructions = static_cast<uint64_t>(get_d("instructions"));
+      res.l1d_misses = static_cast<uint64_t>(get_d("l1d_misses"));
+      res.llc_misses = static_cast<uint64_t>(get_d("llc_misses"));
+      res.branch_misses = static_cast<uint64_t>(get_d("branch_misses"));
+      res.num_allocs = static_cast<uint64_t>(get_d("num_allocs"));
+      res.alloc_bytes = static_cast<uint64_t>(get_d("alloc_bytes"));
+      return res;
+    }
+  
+  }
+  
+  // One object per line, so that the files diff nicely and are easy to read back.
+  std::vector<std::string> to_json(const std::vector<Result>& results)
+  {
+    std::vector<std::string> lines;
+    lines.emplace_back("{");
+    lines.emplace_back("  \"benchmarks\": [");
+    for (size_t r_idx = 0; r_idx < results.size(); ++r_idx)
+    {
+      auto values = detail::result_values(results[r_idx]);
+      std::string line = "    { ";
+      for (size_t f_idx = 0; f_idx < values.size(); ++f_idx)
+      {
+        if (f_idx > 0)
+          line += ", ";
+        line += "\"" + detail::c_result_fields[f_idx] + "\": ";
+        // tag and kind are strings, the rest are numbers.
+        if (f_idx < 2)
+          line += "\"" + detail::json_escape(values[f_idx]) + "\"";
+        else
+          line += detail::json_number(values[f_idx]);
+      }
+      line += r_idx + 1 < results.size() ? " }," : " }";
+      lines.emplace_back(line);
+    }
+    lines.emplace_back("  ]");
+    lines.emplace_back("}");
+    return lines;
+  }
+  
+  std::vector<std::string> to_csv(const std::vector<Result>& results)
+  {
+    std::vector<std::string> lines;
+    std::string header;
+    for (const auto& field : detail::c_result_fields)
+      header += (header.empty() ? "" : ",") + field;
+    lines.emplace_back(header);
+    for (const auto& res : results)
+    {
+      std::string line;
+      auto values = detail::result_values(res);
+      for (size_t f_idx = 0; f_idx < values.size(); ++f_idx)
+        line += (f_idx > 0 ? "," : "") + detail::csv_escape(values[f_idx]);
+      lines.emplace_back(line);
+    }
+    return lines;
+  }
+  
+  // Reads a file written by write_json() or write_csv(), chosen by file extension.
+  bool load_results(const std::string& file_path, std::vector<Result>& results)
+  {
+    std::vector<std::string> lines;
+    if (!TextIO::read_file(file_path, lines))
+      return false;
+    if (file_path.ends_with(".csv"))
+    {
+      if (lines.empty())
+        return false;
+      auto header = detail::split_csv_line(lines[0]);
+      for (size_t l_idx = 1; l_idx < lines.size(); ++l_idx)
+      {
+        if (lines[l_idx].empty())
+          continue;
+        auto cells = detail::split_csv_line(lines[l_idx]);
+        std::map<std::string, std::string> fields;
+        for (size_t c_idx = 0; c_idx < std::min(cells.size(), header.size()); ++c_idx)
+          fields[header[c_idx]] = cells[c_idx];
+        results.emplace_back(detail::result_from_fields(fields));
+      }
+    }
+    else
+    {
+      for (const auto& line : lines)
+        if (line.find("\"tag\"") != std::string::npos)
+          results.emplace_back(detail::result_from_fields(detail::parse_flat_json_object(line)));
+    }
+    return true;
+  }
+  
+  struct Comparison
+  {
+    std::string tag;
+    double baseline_ns = 0.0;
+    double current_ns = 0.0;
+    // current / baseline.
+    double ratio = 1.0;
+    bool regression = false;
+  };
+  
+  // Matches results by tag. A result regresses if its metric is more than
+  //   threshold (e.g. 0.2 = 20%) slower than the baseline.
+  std::vector<Comparison> compare_results(const std::vector<Result>& baseline,
+                                          const std::vector<Result>& current,
+                                          double threshold)
+  {
+    std::vector<Comparison> comparisons;
+    for (const auto& curr : current)
+    {
+      auto it = std::find_if(baseline.begin(), baseline.end(),
+                             [&curr](const auto& base) { return base.tag == curr.tag && base.kind == curr.kind; });
+      if (it == baseline.end())
+        continue;
+      Comparison cmp;
+      cmp.tag = curr.tag;
+      cmp.baseline_ns = it->metric_ns();
+      cmp.current_ns = curr.metric_ns();
+      cmp.ratio = cmp.baseline_ns > 0.0 ? cmp.current_ns / cmp.baseline_ns : 1.0;
+      cmp.regression = cmp.ratio > 1.0 + threshold;
+      comparisons.emplace_back(cmp);
+    }
+    return comparisons;
+  }
+  
+  std::vector<std::string> comparison_lines(const std::vector<Comparison>& comparisons)
+  {
+    std::vector<std::string> lines;
+    int max_tag_len = 0;
+    for (const auto& cmp : comparisons)
+      math::maximize(max_tag_len, static_cast<int>(cmp.tag.size()));
+    const int col_width = 12;
+    for (const auto& cmp : comparisons)
+    {
+      char ratio_buf[32];
+      std::snprintf(ratio_buf, sizeof(ratio_buf), "%+.1f%%", (cmp.ratio - 1.0) * 100.0);
+      lines.emplace_back(str::adjust_str(cmp.tag, str::Adjustment::Left, max_tag_len) + " :"
+        + str::adjust_str(format_ns(cmp.baseline_ns), str::Adjustment::Right, col_width)
+        + " -> "
+        + str::adjust_str(format_ns(cmp.current_ns), str::Adjustment::Right, col_width)
+        + str::adjust_str(ratio_buf, str::Adjustment::Right, 10)
+        + (cmp.regression ? "  REGRESSION" : ""));
+    }
+    return lines;
+  }
+  
+  // ///////////////////
+  //  Trace recorder   //
+  // ///////////////////
+  
+  struct TraceEvent
+  {
+    int64_t ts_ns = 0;
+    uint32_t tag_id = 0;
+    // 'B' = begin, 'E' = end.
+    char phase = 'B';
+  };
+  
+  static constexpr size_t c_trace_ring_size = 1 << 16;
+  
+  // Single-producer/single-consumer ring of trace events for one thread.
+  //   The owning thread pushes without locks. Events are drained into a plain vector
+  //   by whoever flushes the recorder. If the ring is full, events are dropped (and counted).
+  class TraceBuffer
+  {
+    std::unique_ptr<TraceEvent[]> ring { new TraceEvent[c_trace_ring_size] };
+    std::atomic<uint64_t> head { 0 };
+    std::atomic<uint64_t> tail { 0 };
+    std::atomic<uint64_t> num_dropped { 0 };
+    std::vector<TraceEvent> drained;
+    
+  public:
+    const int thread_idx = 0;
+    
+    TraceBuffer(int th_idx) : thread_idx(th_idx) {}
+    
+    void push(const TraceEvent& ev)
+    {
+      auto h = head.load(std::memory_order_relaxed);
+      if (h - tail.load(std::memory_order_acquire) >= c_trace_ring_size)
+      {
+        num_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      ring[h & (c_trace_ring_size - 1)] = ev;
+      head.store(h + 1, std::memory_order_release);
+    }
+    
+    // Consumer side. Must not be called concurrently with itself.
+    void drain()
+    {
+      auto t = tail.load(std::memory_order_relaxed);
+      auto h = head.load(std::memory_order_acquire);
+      for (; t != h; ++t)
+        drained.emplace_back(ring[t & (c_trace_ring_size - 1)]);
+      tail.store(t, std::memory_order_release);
+    }
+    
+    void clear_drained() { drained.clear(); }
+    
+    const std::vector<TraceEvent>& get_drained() const { return drained; }
+    
+    uint64_t get_num_dropped() const { return num_dropped.load(std::memory_order_relaxed); }
+  };
+  
+  // Collects begin/end events from Benchmark::start()/stop() and BM_SCOPE zones while enabled
+  //   and writes them as Chrome trace_event JSON (loads in about://tracing and Perfetto).
+  // Time stamps are taken with DefaultClock.
+  class TraceRecorder
+  {
+    std::atomic<bool> enabled { false };
+    mutable std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    
+    TraceBuffer& local_buffer()
+    {
+      thread_local TraceBuffer* buffer = nullptr;
+      if (buffer == nullptr)
+      {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        auto th_idx = static_cast<int>(buffers.size());
+        buffer = buffers.emplace_back(std::make_unique<TraceBuffer>(th_idx)).get();
+      }
+      return *buffer;
+    }
+    
+  public:
+    void set_enabled(bool enable) { enabled.store(enable, std::memory_order_relaxed); }
+    
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+    
+    void record(TagId tag, char phase, int64_t ts_ns)
+    {
+      local_buffer().push({ ts_ns, tag.id, phase });
+    }
+    
+    // Moves pending events out of the rings. Call periodically from a non-hot thread
+    //   if the workload produces more than c_trace_ring_size events per thread between writes.
+    void flush()
+    {
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      for (auto& buffer : buffers)
+        buffer->drain();
+    }
+    
+    void clear()
+    {
+      flush();
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      for (auto& buffer : buffers)
+        buffer->clear_drained();
+    }
+    
+    uint64_t get_num_dropped() const
+    {
+      uint64_t num_dropped = 0;
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      for (const auto& buffer : buffers)
+        num_dropped += buffer->get_num_dropped();
+      return num_dropped;
+    }
+    
+    std::vector<std::string> to_chrome_trace()
+    {
+      flush();
+      std::lock_guard<std::mutex> lock(buffers_mutex);
+      auto t0_ns = std::numeric_limits<int64_t>::max();
+      for (const auto& buffer : buffers)
+        for (const auto& ev : buffer->get_drained())
+          math::minimize(t0_ns, ev.ts_ns);
+      
+      std::vector<std::string> names;
+      auto get_name = [&names](uint32_t tag_id) -> const std::string&
+      {
+        while (names.size() <= tag_id)
+          names.emplace_back(detail::json_escape(tag_registry().get_name({ static_cast<uint32_t>(names.size()) })));
+        return names[tag_id];
+      };
+      
+      std::vector<std::string> lines;
+      lines.emplace_back("{");
+      lines.emplace_back("  \"displayTimeUnit\": \"ns\",");
+      lines.emplace_back("  \"traceEvents\": [");
+      for (const auto& buffer : buffers)
+      {
+        auto tid = std::to_string(buffer->thread_idx);
+        lines.emplace_back("    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " + tid
+          + ", \"args\": { \"name\": \"thread " + tid + "\" } },");
+        for (const auto& ev : buffer->get_drained())
+        {
+          char ts_buf[32];
+          std::snprintf(ts_buf, sizeof(ts_buf), "%.3f", static_cast<double>(ev.ts_ns - t0_ns) * 1e-3);
+          lines.emplace_back("    { \"name\": \"" + get_name(ev.tag_id) + "\", \"ph\": \"" + ev.phase
+            + "\", \"ts\": " + ts_buf + ", \"pid\": 1, \"tid\": " + tid + " },");
+        }
+      }
+      // No trailing comma allowed on the last event.
+      if (lines.back().ends_with(","))
+        lines.back().pop_back();
+      lines.emplace_back("  ]");
+      lines.emplace_back("}");
+      return lines;
+    }
+    
+    bool write_chrome_trace(const std::string& file_path)
+    {
+      auto num_dropped = get_num_dropped();
+      if (num_dropped > 0)
+        std::cerr << "Warning: " << num_dropped << " trace events were dropped (ring full)." << std::endl;
+      return TextIO::write_file(file_path, to_chrome_trace());
+    }
+  };
+  
+  TraceRecorder& trace_recorder()
+  {
+    static TraceRecorder recorder;
+    return recorder;
+  }
+  
+  // ///////////////////
+  //  Scoped zones     //
+  // ///////////////////
+  
+  // Call tree of zones entered on one thread. Nodes are keyed by their path from the root,
+  //   so the same zone entered from two different parents yields two nodes.
+  class ZoneTree
+  {
+  public:
+    struct Node
+    {
+      const char* name = nullptr;
+      int parent = -1;
+      int first_child = -1;
+      int next_sibling = -1;
+      int64_t inclusive_ns = 0;
+      int64_t num_calls = 0;
+      // Interned lazily, the first time the zone is traced.
+      int trace_tag_id = -1;
+    };
+    
+  private:
+    std::vector<Node> nodes = std::vector<Node>(1, Node { "root" });
+    int curr_idx = 0;
+    
+    int find_or_add_child(int parent_idx, const char* name)
+    {
+      int last_child = -1;
+      for (int c = nodes[parent_idx].first_child; c != -1; c = nodes[c].next_sibling)
+      {
+        if (nodes[c].name == name || std::strcmp(nodes[c].name, name) == 0)
+          return c;
+        last_child = c;
+      }
+      auto new_idx = static_cast<int>(nodes.size());
+      Node node;
+      node.name = name;
+      node.parent = parent_idx;
+      nodes.emplace_back(node);
+      if (last_child == -1)
+        nodes[parent_idx].first_child = new_idx;
+      else
+        nodes[last_child].next_sibling = new_idx;
+      return new_idx;
+    }
+    
+    void merge_subtree(const ZoneTree& other, int other_idx, int this_idx)
+    {
+      for (int c = other.nodes[other_idx].first_child; c != -1; c = other.nodes[c].next_sibling)
+      {
+        const auto& src = other.nodes[c];
+        auto dst_idx = find_or_add_child(this_idx, src.name);
+        nodes[dst_idx].inclusive_ns += src.inclusive_ns;
+        nodes[dst_idx].num_calls += src.num_calls;
+        merge_subtree(other, c, dst_idx);
+      }
+    }
+    
+    // Adds the children of now_idx in now, minus their totals in before (before_idx -1 if absent),
+    //   below this_idx. Children without calls and without descendants with calls are left out.
+    void add_difference(const ZoneTree& now, int now_idx, const ZoneTree& before, int before_idx, int this_idx)
+    {
+      int last_child = -1;
+      for (int c = now.nodes[now_idx].first_child; c != -1; c = now.nodes[c].next_sibling)
+      {
+        const auto& src = now.nodes[c];
+        int before_c = -1;
+        if (before_idx != -1)
+          for (int b = before.nodes[before_idx].first_child; b != -1; b = before.nodes[b].next_sibling)
+            if (std::strcmp(before.nodes[b].name, src.name) == 0)
+            {
+              before_c = b;
+              break;
+            }
+        auto dst_idx = static_cast<int>(nodes.size());
+        Node node;
+        node.name = src.name;
+        node.parent = this_idx;
+        node.inclusive_ns = src.inclusive_ns - (before_c == -1 ? 0 : before.nodes[before_c].inclusive_ns);
+        node.num_calls = src.num_calls - (before_c == -1 ? 0 : before.nodes[before_c].num_calls);
+        nodes.emplace_back(node);
+        add_difference(now, c, before, before_c, dst_idx);
+        // Empty subtrees have been dropped already, so this node is still the last one.
+        if (node.num_calls == 0 && nodes[dst_idx].first_child == -1)
+        {
+          nodes.pop_back();
+          continue;
+        }
+        if (last_child == -1)
+          nodes[this_idx].first_child = dst_idx;
+        else
+          nodes[last_child].next_sibling = dst_idx;
+        last_child = dst_idx;
+      }
+    }
+    
+  public:
+    // Returns the index of the entered node.
+    int enter(const char* name)
+    {
+      curr_idx = find_or_add_child(curr_idx, name);
+      return curr_idx;
+    }
+    
+    void exit(int node_idx, int64_t dt_ns)
+    {
+      // Guards against the tree having been cleared while the zone was open.
+      if (node_idx <= 0 || node_idx >= static_cast<int>(nodes.size()))
+        return;
+      auto& node = nodes[node_idx];
+      node.inclusive_ns += dt_ns;
+      node.num_calls++;
+      curr_idx = node.parent;
+    }
+    
+    TagId get_trace_tag(int node_idx)
+    {
+      auto& node = nodes[node_idx];
+      if (node.trace_tag_id < 0)
+        node.trace_tag_id = static_cast<int>(tag_registry().intern(node.name).id);
+      return { static_cast<uint32_t>(node.trace_tag_id) };
+    }
+    
+    void merge(const ZoneTree& other)
+    {
+      merge_subtree(other, 0, 0);
+    }
+    
+    // The calls in now that are not in before, where before is an earlier state of now,
+    //   e.g. a previous merge of the same trees.
+    static ZoneTree difference(const ZoneTree& now, const ZoneTree& before)
+    {
+      ZoneTree diff;
+      diff.add_difference(now, 0, before, 0, 0);
+      return diff;
+    }
+    
+    void clear()
+    {
+      nodes.resize(1);
+      nodes[0].first_child = -1;
+      curr_idx = 0;
+    }
+    
+    bool empty() const { return nodes.size() <= 1; }
+    
+    const std::vector<Node>& get_nodes() const { return nodes; }
+    
+    int64_t exclusive_ns(int node_idx) const
+    {
+      auto excl_ns = nodes[node_idx].inclusive_ns;
+      for (int c = nodes[node_idx].first_child; c != -1; c = nodes[c].next_sibling)
+        excl_ns -= nodes[c].inclusive_ns;
+      return excl_ns;
+    }
+    
+    // Depth-first visit of all nodes except the root. func(node_idx, depth).
+    template<typename Lambda>
+    void visit(Lambda&& func, int node_idx = 0, int depth = -1) const
+    {
+      if (node_idx != 0)
+        func(node_idx, depth);
+      for (int c = nodes[node_idx].first_child; c != -1; c = nodes[c].next_sibling)
+        visit(func, c, depth + 1);
+    }
+  };
+  
+  // Owns one ZoneTree per thread. Trees are merged when reporting,
+  //   so worker threads must be done with their zones by then.
+  // There is a single, global profiler (see zone_profiler()), since zones are not tied to a Benchmark.
+  //   It remembers what has been reported, so each Benchmark print only shows the zones recorded
+  //   since the previous report of any instance.
+  class ZoneProfiler
+  {
+    mutable std::mutex trees_mutex;
+    std::vector<std::unique_ptr<ZoneTree>> trees;
+    // The merged trees at the last take_unreported().
+    ZoneTree reported;
+    
+    ZoneTree merge_locked() const
+    {
+      ZoneTree merged;
+      for (const auto& tree : trees)
+        merged.merge(*tree);
+      return merged;
+    }
     
-    std::chrono::duration<float, std::milli> elapsed_time = end_time - start_time;
-    return elapsed_time.count();
+  public:
+    ZoneTree& local_tree()
+    {
+      thread_local ZoneTree* tree = nullptr;
+      if (tree == nullptr)
+      {
+        std::lock_guard<std::mutex> lock(trees_mutex);
+        tree = trees.emplace_back(std::make_unique<ZoneTree>()).get();
+      }
+      return *tree;
+    }
+    
+    // All zones recorded since the last clear().
+    ZoneTree merge() const
+    {
+      std::lock_guard<std::mutex> lock(trees_mutex);
+      return merge_locked();
+    }
+    
+    // The zones recorded since the previous call, which are then marked as reported.
+    ZoneTree take_unreported()
+    {
+      std::lock_guard<std::mutex> lock(trees_mutex);
+      auto merged = merge_locked();
+      auto unreported = ZoneTree::difference(merged, reported);
+      reported = std::move(merged);
+      return unreported;
+    }
+    
+    void clear()
+    {
+      std::lock_guard<std::mutex> lock(trees_mutex);
+      for (auto& tree : trees)
+        tree->clear();
+      reported.clear();
+    }
+  };
+  
+  ZoneProfiler& zone_profiler()
+  {
+    static ZoneProfiler profiler;
+    return profiler;
   }
   
-  std::chrono::time_point<std::chrono::steady_clock> benchmark_tictoc_time;
+  // RAII zone. name must outlive the profiler, e.g. a string literal.
+  class ScopeZone
+  {
+    ZoneTree& tree;
+    int node_idx = 0;
+    int64_t start_ns = 0;
+    
+  public:
+    ScopeZone(const char* name)
+      : tree(zone_profiler().local_tree())
+    {
+      node_idx = tree.enter(name);
+      start_ns = DefaultClock::now_ns();
+      if (trace_recorder().is_enabled())
+        trace_recorder().record(tree.get_trace_tag(node_idx), 'B', start_ns);
+    }
+    
+    ~ScopeZone()
+    {
+      auto end_ns = DefaultClock::now_ns();
+      if (trace_recorder().is_enabled())
+        trace_recorder().record(tree.get_trace_tag(node_idx), 'E', end_ns);
+      tree.exit(node_idx, end_ns - start_ns);
+    }
+    
+    ScopeZone(const ScopeZone&) = delete;
+    ScopeZone& operator=(const ScopeZone&) = delete;
+  };
   
-  void tic()
+  // Zone tree as text lines, with the same column layout used by Benchmark::print().
+  std::vector<std::string> zone_tree_lines(const ZoneTree& tree)
   {
-    benchmark_tictoc_time = std::chrono::steady_clock::now();
+    std::vector<std::string> lines;
+    if (tree.empty())
+      return lines;
+    const auto& nodes = tree.get_nodes();
+    int max_name_len = 4;
+    tree.visit([&](int idx, int depth)
+    {
+      math::maximize(max_name_len, 2*depth + static_cast<int>(std::strlen(nodes[idx].name)));
+    });
+    const int col_width = 12;
+    lines.emplace_back(str::adjust_str("zone", str::Adjustment::Left, max_name_len) + " :"
+      + str::adjust_str("incl ms", str::Adjustment::Right, col_width)
+      + str::adjust_str("excl ms", str::Adjustment::Right, col_width)
+      + str::adjust_str("calls", str::Adjustment::Right, col_width));
+    tree.visit([&](int idx, int depth)
+    {
+      char incl_buf[32];
+      char excl_buf[32];
+      std::snprintf(incl_buf, sizeof(incl_buf), "%.3f", ns_to_ms(nodes[idx].inclusive_ns));
+      std::snprintf(excl_buf, sizeof(excl_buf), "%.3f", ns_to_ms(tree.exclusive_ns(idx)));
+      auto indented_name = str::rep_char(' ', 2*depth) + nodes[idx].name;
+      lines.emplace_back(str::adjust_str(indented_name, str::Adjustment::Left, max_name_len) + " :"
+        + str::adjust_str(incl_buf, str::Adjustment::Right, col_width)
+        + str::adjust_str(excl_buf, str::Adjustment::Right, col_width)
+        + str::adjust_str(std::to_string(nodes[idx].num_calls), str::Adjustment::Right, col_width));
+    });
+    return lines;
   }
   
-  float toc()
+  // Counter table for the timers that have hardware counter data.
+  std::vector<std::string> hw_counter_lines(const std::map<std::string, Timer>& timers)
+  {
+    std::vector<std::string> lines;
+    int max_tag_len = 0;
+    for (const auto& [tag, timer] : timers)
+      if (timer.hw.cycles > 0)
+        math::maximize(max_tag_len, static_cast<int>(tag.size()));
+    if (max_tag_len == 0)
+      return lines;
+    const int col_width = 14;
+    auto header = str::adjust_str("", str::Adjustment::Left, max_tag_len) + " :";
+    for (const auto* col : { "cycles", "instructions", "IPC", "L1D misses", "LLC misses", "br misses" })
+      header += str::adjust_str(col, str::Adjustment::Right, col_width);
+    lines.emplace_back(header);
+    for (const auto& [tag, timer] : timers)
+    {
+      if (timer.hw.cycles == 0)
+        continue;
+      char ipc_buf[32];
+      std::snprintf(ipc_buf, sizeof(ipc_buf), "%.2f", timer.hw.ipc());
+      auto line = str::adjust_str(tag, str::Adjustment::Left, max_tag_len) + " :";
+      line += str::adjust_str(std::to_string(timer.hw.cycles), str::Adjustment::Right, col_width);
+      line += str::adjust_str(std::to_string(timer.hw.instructions), str::Adjustment::Right, col_width);
+      line += str::adjust_str(ipc_buf, str::Adjustment::Right, col_width);
+      line += str::adjust_str(std::to_string(timer.hw.l1d_misses), str::Adjustment::Right, col_width);
+      line += str::adjust_str(std::to_string(timer.hw.llc_misses), str::Adjustment::Right, col_width);
+      line += str::adjust_str(std::to_string(timer.hw.branch_misses), str::Adjustment::Right, col_width);
+      lines.emplace_back(line);
+    }
+    return lines;
+  }
+  
+  std::vector<std::string> alloc_counter_lines(const std::map<std::string, Timer>& timers)
+  {
+    std::vector<std::string> lines;
+    int max_tag_len = 0;
+    for (const auto& [tag, timer] : timers)
+      math::maximize(max_tag_len, static_cast<int>(tag.size()));
+    const int col_width = 14;
+    auto header = str::adjust_str("", str::Adjustment::Left, max_tag_len) + " :";
+    for (const auto* col : { "allocs", "bytes", "allocs/call", "bytes/call" })
+      header += str::adjust_str(col, str::Adjustment::Right, col_width);
+    lines.emplace_back(header);
+    for (const auto& [tag, timer] : timers)
+    {
+      auto num_calls = static_cast<double>(std::max<int64_t>(timer.num_calls, 1));
+      char allocs_per_call[32];
+      char bytes_per_call[32];
+      std::snprintf(allocs_per_call, sizeof(allocs_per_call), "%.2f", timer.alloc.num_allocs / num_calls);
+      std::snprintf(bytes_per_call, sizeof(bytes_per_call), "%.1f", timer.alloc.num_bytes / num_calls);
+      auto line = str::adjust_str(tag, str::Adjustment::Left, max_tag_len) + " :";
+      line += str::adjust_str(std::to_string(timer.alloc.num_allocs), str::Adjustment::Right, col_width);
+      line += str::adjust_str(std::to_string(timer.alloc.num_bytes), str::Adjustment::Right, col_width);
+      line += str::adjust_str(allocs_per_call, str::Adjustment::Right, col_width);
+      line += str::adjust_str(bytes_per_call, str::Adjustment::Right, col_width);
+      lines.emplace_back(line);
+    }
+    return lines;
+  }
+  
+  // ##################
+  // #     Title      #
+  // ##################
+  // # .............. #
+  // # .............. #
+  // ##################
+  void print_framed(const std::string& title, const std::vector<std::string>& lines)
   {
-    auto end_time = std::chrono::steady_clock::now();
-    std::chrono::duration<float, std::milli> elapsed_time = end_time - benchmark_tictoc_time;
-    return elapsed_time.count();
+    if (lines.empty())
+      return;
+    int max_line_len = static_cast<int>(title.size());
+    for (const auto& l : lines)
+      math::maximize(max_line_len, static_cast<int>(l.size()));
+    auto frame_width = max_line_len + 4;
+    auto horiz_str = str::rep_char('#', frame_width);
+    std::cout << horiz_str << std::endl;
+    std::cout << "# " << str::adjust_str(title, str::Adjustment::Center, frame_width - 3) << " #" << std::endl;
+    std::cout << horiz_str << std::endl;
+    for (const auto& l : lines)
+      std::cout << "# " << str::adjust_str(l, str::Adjustment::Left, max_line_len) << " #" << std::endl;
+    std::cout << horiz_str << std::endl;
   }
   
-  class Benchmark
+  // Timers are sharded per thread: start()/stop()/reg() only touch the calling thread's shard,
+  //   so no locks are taken on the hot path. A mutex is only taken the first time a thread
+  //   touches a Benchmark instance and when shards are merged for reporting.
+  // Shards are merged when reporting (print(), get_time_ms(), ...),
+  //   so worker threads must be done with their timers (e.g. joined) by then.
+  template<typename Clock = DefaultClock>
+  class BasicBenchmark
   {
-    std::map<std::string, float> timers_ms;
-    std::map<std::string, std::chrono::steady_clock::time_point> start_times;
+    // Everything read at the start and at the end of a timed section.
+    struct Sample
+    {
+      int64_t time_ns = 0;
+      HwCounters hw;
+      AllocCounters alloc;
+    };
+    
+    struct Shard
+    {
+      std::map<std::string, Timer> timers;
+      std::map<std::string, Sample> starts;
+      // Flat storage for interned tags, indexed by tag id. Grown to the registry size the first time
+      //   a higher id is used, so a shard only holds as many tags as have been interned.
+      std::vector<Timer> tag_timers;
+      std::vector<Sample> tag_starts;
+      
+      void reserve_tag(TagId tag)
+      {
+        if (tag.id < tag_timers.size())
+          return;
+        auto num_tags = std::max<size_t>(tag.id + 1, tag_registry().size());
+        tag_timers.resize(num_tags);
+        tag_starts.resize(num_tags);
+      }
+      
+      Timer& tag_timer(TagId tag)
+      {
+        reserve_tag(tag);
+        return tag_timers[tag.id];
+      }
+      
+      Sample& tag_start(TagId tag)
+      {
+        reserve_tag(tag);
+        return tag_starts[tag.id];
+      }
+    };
+    
+    utils::detail::PerThreadShards<Shard> shards;
+    mutable std::mutex stats_mutex;
+    std::map<std::string, Stats> stats_per_tag;
+    bool print_on_destruction = true;
+    std::atomic<bool> hw_counters_enabled { false };
+    std::atomic<bool> alloc_tracking_enabled { false };
+    
+    bool use_hw_counters() const
+    {
+      return hw_counters_enabled.load(std::memory_order_relaxed);
+    }
+    
+    bool use_alloc_tracking() const
+    {
+      return alloc_tracking_enabled.load(std::memory_order_relaxed);
+    }
+    
+    // The clock is read innermost, so that reading the other counters is not timed.
+    void sample_start(Sample& sample)
+    {
+      if (use_hw_counters())
+        sample.hw = local_perf_counters().read_counters();
+      if (use_alloc_tracking())
+        sample.alloc = get_alloc_counters();
+      sample.time_ns = Clock::now_ns();
+    }
+    
+    Sample sample_end()
+    {
+      Sample sample;
+      sample.time_ns = Clock::now_ns();
+      if (use_alloc_tracking())
+        sample.alloc = get_alloc_counters();
+      if (use_hw_counters())
+        sample.hw = local_perf_counters().read_counters();
+      return sample;
+    }
+    
+    void accumulate(Timer& timer, const Sample& start_sample, const Sample& end_sample)
+    {
+      timer.add(end_sample.time_ns - start_sample.time_ns);
+      if (use_hw_counters())
+        timer.hw += end_sample.hw - start_sample.hw;
+      if (use_alloc_tracking())
+        timer.alloc += end_sample.alloc - start_sample.alloc;
+    }
+    
+    // A thread must get the same shard back for as long as the instance lives, or stop() would
+    //   pair with a fresh, zeroed start sample.
+    Shard& local_shard()
+    {
+      return shards.local();
+    }
+    
+    template<typename Lambda>
+    void reg_timer(Lambda& func, Timer& timer)
+    {
+      Sample start_sample;
+      sample_start(start_sample);
+      func();
+      accumulate(timer, start_sample, sample_end());
+    }
+    
+    // Trace time stamps always use DefaultClock so that all events share one time line.
+    void trace(TagId tag, char phase, int64_t now_ns)
+    {
+      if constexpr (!std::is_same_v<Clock, DefaultClock>)
+        now_ns = DefaultClock::now_ns();
+      trace_recorder().record(tag, phase, now_ns);
+    }
+    
+    std::map<std::string, Timer> merge_timers() const
+    {
+      std::map<std::string, Timer> merged;
+      shards.for_each([&](const Shard& shard)
+      {
+        for (const auto& [tag, timer] : shard.timers)
+          merged[tag].merge(timer);
+        for (uint32_t t = 0; t < shard.tag_timers.size(); ++t)
+          if (shard.tag_timers[t].num_calls > 0)
+            merged[tag_registry().get_name({ t })].merge(shard.tag_timers[t]);
+      });
+      return merged;
+    }
     
     void print()
     {
+      auto timers = merge_timers();
       int max_tag_len = 0;
       int max_time_len = 0;
-      for (const auto& [tag, time_ms] : timers_ms)
+      for (const auto& [tag, timer] : timers)
       {
         math::maximize(max_tag_len, static_cast<int>(tag.size()));
-        math::maximize(max_time_len, static_cast<int>(std::to_string(time_ms).size()));
+        math::maximize(max_time_len, static_cast<int>(std::to_string(ns_to_ms(timer.total_ns)).size()));
       }
       
       std::vector<std::string> lines;
-      for (const auto& [tag, time_ms] : timers_ms)
+      for (const auto& [tag, timer] : timers)
         lines.emplace_back(str::adjust_str(tag, str::Adjustment::Left, max_tag_len)
           + " : "
-          + str::adjust_str(std::to_string(time_ms), str::Adjustment::Left, max_time_len)
+          + str::adjust_str(std::to_string(ns_to_ms(timer.total_ns)), str::Adjustment::Left, max_time_len)
           + " ms");
       
-      // ##################
-      // #   Benchmark    #
-      // ##################
-      // # .............. #
-      // # .............. #
-      // ##################
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      if (!stats_per_tag.empty())
+      {
+        const std::vector<std::string> columns { "min", "median", "mean", "p95", "p99", "stddev" };
+        const int col_width = 12;
+        int max_stats_tag_len = 0;
+        for (const auto& [tag, stats] : stats_per_tag)
+          math::maximize(max_stats_tag_len, static_cast<int>(tag.size()));
+        auto header = str::adjust_str("", str::Adjustment::Left, max_stats_tag_len) + " :";
+        for (const auto& col : columns)
+          header += str::adjust_str(col, str::Adjustment::Right, col_width);
+        header += "    iters x reps";
+        lines.emplace_back(header);
+        for (const auto& [tag, stats] : stats_per_tag)
+        {
+          auto line = str::adjust_str(tag, str::Adjustment::Left, max_stats_tag_len) + " :";
+          for (auto val : { stats.min_ns, stats.median_ns, stats.mean_ns, stats.p95_ns, stats.p99_ns, stats.stddev_ns })
+            line += str::adjust_str(format_ns(val), str::Adjustment::Right, col_width);
+          line += "    " + std::to_string(stats.num_iterations) + " x " + std::to_string(stats.num_repetitions);
+          lines.emplace_back(line);
+        }
+      }
       
-      if (lines.empty())
-        return;
-      auto frame_width = static_cast<int>(lines.back().size() + 4);
-      auto horiz_str = str::rep_char('#', frame_width);
-      std::cout << horiz_str << std::endl;
-      std::cout << "# " << str::adjust_str("BENCHMARK", str::Adjustment::Center, frame_width - 3) << " #" << std::endl;
-      std::cout << horiz_str << std::endl;
-      for (const auto& l : lines)
-        std::cout << "# " << l << " #" << std::endl;
-      std::cout << horiz_str << std::endl;
+      auto hw_lines = hw_counter_lines(timers);
+      lines.insert(lines.end(), hw_lines.begin(), hw_lines.end());
+      
+      if (use_alloc_tracking())
+      {
+        auto alloc_lines = alloc_counter_lines(timers);
+        lines.insert(lines.end(), alloc_lines.begin(), alloc_lines.end());
+      }
+      
+      // Zones are global, so this reports and consumes the zones of all threads and instances.
+      auto zone_lines = zone_tree_lines(zone_profiler().take_unreported());
+      lines.insert(lines.end(), zone_lines.begin(), zone_lines.end());
+      
+      print_framed("BENCHMARK", lines);
     }
     
   public:
-    ~Benchmark()
+    BasicBenchmark()
+    {
+      // Primes one-off clock initialization (e.g. TSC calibration) outside of any measurement.
+      Clock::now_ns();
+    }
+    
+    ~BasicBenchmark()
     {
-      print();
+      if (print_on_destruction)
+        print();
+    }
+    
+    // Also samples hardware counters (cycles, instructions, cache and branch misses) in
+    //   start()/stop()/reg(). Returns false, leaving counters off, if perf events
+    //   are not available to the calling thread.
+    bool enable_hw_counters(bool enable = true)
+    {
+      if (enable && !local_perf_counters().is_available())
+      {
+        std::cerr << "Warning: Hardware performance counters are not available." << std::endl;
+        enable = false;
+      }
+      hw_counters_enabled.store(enable, std::memory_order_relaxed);
+      return enable;
+    }
+    
+    // Also counts heap allocations and allocated bytes per tag. Requires the operator new hooks,
+    //   see get_alloc_counters(). Returns false, leaving tracking off, if they are not compiled in.
+    bool enable_alloc_tracking(bool enable = true)
+    {
+      if (enable && !c_alloc_hooks_compiled)
+      {
+        std::cerr << "Warning: Allocation tracking requires BM_TRACK_ALLOCATIONS to be defined." << std::endl;
+        enable = false;
+      }
+      alloc_tracking_enabled.store(enable, std::memory_order_relaxed);
+      return enable;
+    }
+    
+    // E.g. when only machine-readable output is wanted.
+    void set_print_on_destruction(bool enable)
+    {
+      print_on_destruction = enable;
+    }
+    
+    std::vector<Result> collect_results() const
+    {
+      std::vector<Result> results;
+      for (const auto& [tag, timer] : merge_timers())
+        results.emplace_back(make_result(tag, timer));
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      for (const auto& [tag, stats] : stats_per_tag)
+        results.emplace_back(make_result(tag, stats));
+      return results;
+    }
+    
+    bool write_json(const std::string& file_path) const
+    {
+      return TextIO::write_file(file_path, to_json(collect_results()));
+    }
+    
+    bool write_csv(const std::string& file_path) const
+    {
+      return TextIO::write_file(file_path, to_csv(collect_results()));
+    }
+    
+    // Compares against a result file from an earlier run and prints the comparison.
+    // Returns false if any result regressed by more than threshold (e.g. 0.2 = 20%)
+    //   or if the baseline could not be loaded.
+    bool compare_to_baseline(const std::string& baseline_file_path, double threshold = 0.1,
+                             std::vector<Comparison>* comparisons = nullptr) const
+    {
+      std::vector<Result> baseline;
+      if (!load_results(baseline_file_path, baseline))
+        return false;
+      auto cmps = compare_results(baseline, collect_results(), threshold);
+      print_framed("BASELINE COMPARISON", comparison_lines(cmps));
+      utils::try_set(comparisons, cmps);
+      return std::none_of(cmps.begin(), cmps.end(), [](const auto& cmp) { return cmp.regression; });
     }
     
     template<typename Lambda>
     void reg(Lambda&& func, const std::string& tag)
     {
-      timers_ms[tag] += calc_time_ms(func);
+      reg_timer(func, local_shard().timers[tag]);
+    }
+    
+    template<typename Lambda>
+    void reg(Lambda&& func, TagId tag)
+    {
+      reg_timer(func, local_shard().tag_timer(tag));
+    }
+    
+    // Warms up, calibrates the iteration count and then times repeated batches of func.
+    template<typename Lambda>
+    const Stats& run(Lambda&& func, const std::string& tag, const RunConfig& cfg = {})
+    {
+      auto stats = measure<Clock>(func, cfg);
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return stats_per_tag[tag] = stats;
     }
     
+    // Tracing string tags interns them on every call. Prefer TagId tags when tracing.
     void start(const std::string& tag)
     {
-      start_times[tag] = std::chrono::steady_clock::now();
+      auto& start_sample = local_shard().starts[tag];
+      sample_start(start_sample);
+      if (trace_recorder().is_enabled())
+        trace(tag_registry().intern(tag), 'B', start_sample.time_ns);
     }
     
     void stop(const std::string& tag)
     {
-      auto end_time = std::chrono::steady_clock::now();
-      std::chrono::duration<float, std::milli> elapsed_time = end_time - start_times[tag];
-      timers_ms[tag] += elapsed_time.count();
+      auto end_sample = sample_end();
+      auto& shard = local_shard();
+      accumulate(shard.timers[tag], shard.starts[tag], end_sample);
+      if (trace_recorder().is_enabled())
+        trace(tag_registry().intern(tag), 'E', end_sample.time_ns);
+    }
+    
+    // Interned-tag variants: no allocation and no map lookup.
+    void start(TagId tag)
+    {
+      auto& start_sample = local_shard().tag_start(tag);
+      sample_start(start_sample);
+      if (trace_recorder().is_enabled())
+        trace(tag, 'B', start_sample.time_ns);
+    }
+    
+    void stop(TagId tag)
+    {
+      auto end_sample = sample_end();
+      auto& shard = local_shard();
+      accumulate(shard.tag_timer(tag), shard.tag_start(tag), end_sample);
+      if (trace_recorder().is_enabled())
+        trace(tag, 'E', end_sample.time_ns);
+    }
+    
+    // Accumulated time in ms for tag over all threads, or 0 if tag has not been timed.
+    double get_time_ms(const std::string& tag) const
+    {
+      return ns_to_ms(get_timer(tag).total_ns);
+    }
+    
+    int64_t get_num_calls(const std::string& tag) const
+    {
+      return get_timer(tag).num_calls;
+    }
+    
+    Timer get_timer(TagId tag) const
+    {
+      Timer merged;
+      shards.for_each([&](const Shard& shard)
+      {
+        if (tag.id < shard.tag_timers.size())
+          merged.merge(shard.tag_timers[tag.id]);
+      });
+      return merged;
+    }
+    
+    // Number of threads that have timed anything with this instance.
+    size_t get_num_shards() const { return shards.size(); }
+    
+    // Timers started with string tags only. See get_timer(TagId) for interned tags.
+    Timer get_timer(const std::string& tag) const
+    {
+      Timer merged;
+      shards.for_each([&](const Shard& shard)
+      {
+        auto it = shard.timers.find(tag);
+        if (it != shard.timers.end())
+          merged.merge(it->second);
+      });
+      return merged;
     }
   };
   
+  // Benchmark on the default clock. A plain class name, so that it can be used as e.g. a data member type.
+  using Benchmark = BasicBenchmark<DefaultClock>;
+  
+}
+
+#ifdef BM_TRACK_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+namespace benchmark::detail
+{
+
+  inline void* counted_malloc(std::size_t size)
+  {
+    thread_alloc_counters.num_allocs++;
+    thread_alloc_counters.num_bytes += size;
+    return std::malloc(size == 0 ? 1 : size);
+  }
+  
+  inline void* counted_aligned_malloc(std::size_t size, std::align_val_t al)
+  {
+    thread_alloc_counters.num_allocs++;
+    thread_alloc_counters.num_bytes += size;
+    auto alignment = std::max(static_cast<std::size_t>(al), sizeof(void*));
+#ifdef _WIN32
+    return _aligned_malloc(size == 0 ? 1 : size, alignment);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignment, size == 0 ? 1 : size) != 0)
+      return nullptr;
+    return ptr;
+#endif
+  }
+  
+  inline void aligned_free(void* ptr)
+  {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+
+}
+
+// GCC cannot tell that these operators pair malloc with free.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+  if (auto* ptr = benchmark::detail::counted_malloc(size))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  return benchmark::detail::counted_malloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  return benchmark::detail::counted_malloc(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t al)
+{
+  if (auto* ptr = benchmark::detail::counted_aligned_malloc(size, al))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t al)
+{
+  return ::operator new(size, al);
 }
+
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+  return benchmark::detail::counted_aligned_malloc(size, al);
+}
+
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+  return benchmark::detail::counted_aligned_malloc(size, al);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { benchmark::detail::aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { benchmark::detail::aligned_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { benchmark::detail::aligned_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { benchmark::detail::aligned_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { benchmark::detail::aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { benchmark::detail::aligned_free(ptr); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
@@ -0,0 +1,135 @@
+//
+//  ConcurrentHistogram.h
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Histogram.h"
+#include "PerThreadShards.h"
+#include <atomic>
+#include <memory>
+
+
+namespace hist
+{
+
+  // Records samples from any number of threads without locking, with the same bucket layout as a Histogram.
+  // Each thread gets its own shard of bucket counters the first time it records into an instance
+  //   (the only time a mutex is taken). A shard has a single writer, so counters are bumped with a
+  //   relaxed load and store rather than a locked read-modify-write, and threads do not contend.
+  // snapshot() and merge_into() sum the shards while writers keep going. Every sample is counted
+  //   exactly once, but samples recorded during the snapshot may or may not be included in it.
+  template<typename T>
+  class ConcurrentHistogram
+  {
+    struct Shard
+    {
+      // num_buckets bucket counts followed by underflow and overflow.
+      std::unique_ptr<std::atomic<size_t>[]> counts;
+      // Counts already handed out by snapshot_and_reset(). Only touched by collect().
+      std::vector<size_t> reset_counts;
+    };
+    
+    // Empty, count-only histogram that only provides the bucket layout.
+    Histogram<T> layout;
+    size_t num_buckets = 0;
+    utils::detail::PerThreadShards<Shard> shards;
+    
+    Shard& local_shard()
+    {
+      return shards.local([this]()
+      {
+        auto shard = std::make_unique<Shard>();
+        shard->counts = std::make_unique<std::atomic<size_t>[]>(num_buckets + 2);
+        for (size_t c_idx = 0; c_idx < num_buckets + 2; ++c_idx)
+          shard->counts[c_idx].store(0, std::memory_order_relaxed);
+        shard->reset_counts.resize(num_buckets + 2, 0);
+        return shard;
+      });
+    }
+    
+    std::vector<size_t> collect(bool reset, size_t& underflow, size_t& overflow) const
+    {
+      std::vector<size_t> counts(num_buckets + 2, 0);
+      // reset_counts is only touched here, with the shards locked.
+      shards.for_each([&](Shard& shard)
+      {
+        for (size_t c_idx = 0; c_idx < num_buckets + 2; ++c_idx)
+        {
+          auto cnt = shard.counts[c_idx].load(std::memory_order_relaxed);
+          counts[c_idx] += cnt - shard.reset_counts[c_idx];
+          if (reset)
+            shard.reset_counts[c_idx] = cnt;
+        }
+      });
+      underflow = counts[num_buckets];
+      overflow = counts[num_buckets + 1];
+      counts.resize(num_buckets);
+      return counts;
+    }
+
+  public:
+    ConcurrentHistogram(size_t N_buck, T start, T end)
+      : layout(N_buck, start, end), num_buckets(layout.get_num_buckets())
+    {}
+    
+    // Safe to call from any thread.
+    void operator+=(T val)
+    {
+      auto b_idx = layout.bucket_index(val);
+      auto c_idx = b_idx < 0 ? num_buckets :
+        (b_idx >= static_cast<long>(num_buckets) ? num_buckets + 1 : static_cast<size_t>(b_idx));
+      auto& cnt = local_shard().counts[c_idx];
+      cnt.store(cnt.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    
+    // Count-only histogram with the current counts.
+    Histogram<T> snapshot() const
+    {
+      Histogram<T> snap(num_buckets, layout.get_range_start(), layout.get_range_end());
+      merge_into(snap);
+      return snap;
+    }
+    
+    // Like snapshot(), but the next snapshot only counts samples recorded after this one,
+    //   e.g. for per-interval reporting. Writers are never reset, so no sample is lost.
+    Histogram<T> snapshot_and_reset()
+    {
+      Histogram<T> snap(num_buckets, layout.get_range_start(), layout.get_range_end());
+      size_t underflow = 0, overflow = 0;
+      auto counts = collect(true, underflow, overflow);
+      snap.add_counts(counts, underflow, overflow);
+      return snap;
+    }
+    
+    // Adds the current counts to a count-only histogram.
+    //   If dst has another bucket layout, the counts are re-binned with Histogram::rebin_counts().
+    // Returns false if dst retains its samples.
+    bool merge_into(Histogram<T>& dst) const
+    {
+      if (dst.retains_samples())
+        return false;
+      size_t underflow = 0, overflow = 0;
+      auto counts = collect(false, underflow, overflow);
+      if (dst.get_num_buckets() == num_buckets
+          && dst.get_range_start() == layout.get_range_start()
+          && dst.get_range_end() == layout.get_range_end())
+        return dst.add_counts(counts, underflow, overflow);
+      
+      Histogram<T> snap(num_buckets, layout.get_range_start(), layout.get_range_end());
+      snap.add_counts(counts, underflow, overflow);
+      size_t new_underflow = 0, new_overflow = 0;
+      auto new_counts = snap.rebin_counts(dst.get_num_buckets(), dst.get_range_start(), dst.get_range_end(),
+                                          &new_underflow, &new_overflow);
+      return dst.add_counts(new_counts, new_underflow, new_overflow);
+    }
+    
+    size_t get_num_buckets() const { return num_buckets; }
+    
+    // Number of threads that have recorded into this histogram.
+    size_t get_num_shards() const { return shards.size(); }
+  };
+
+}
@@ -0,0 +1,275 @@
+//
+//  HdrHistogram.h
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Histogram.h"
+#include <bit>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+
+
+namespace hist
+{
+
+  // Log-linear histogram in the style of HdrHistogram, meant for latencies spanning many orders of magnitude
+  //   (e.g. nanoseconds to seconds).
+  // Values are non-negative integers in [0, highest_trackable]. Every power of two range is split into
+  //   linearly spaced sub-buckets, fine enough that any recorded value is reported with significant_digits
+  //   decimal digits of precision. lowest_discernible is the smallest resolution that matters (e.g. 1 ns).
+  // Memory is fixed by the constructor arguments and does not grow with the number of samples.
+  // Negative values are counted as underflow and values above highest_trackable as overflow.
+  class HdrHistogram
+  {
+    int64_t lowest_discernible = 1;
+    int64_t highest_trackable = 0;
+    int significant_digits = 3;
+    int unit_magnitude = 0;
+    int sub_bucket_half_count_magnitude = 0;
+    int64_t sub_bucket_count = 0;
+    int64_t sub_bucket_half_count = 0;
+    int64_t sub_bucket_mask = 0;
+    int bucket_count = 0;
+    std::vector<size_t> counts;
+    size_t total_count = 0;
+    size_t num_underflow = 0;
+    size_t num_overflow = 0;
+    int64_t min_value = std::numeric_limits<int64_t>::max();
+    int64_t max_value = 0;
+    
+    static int floor_log2(int64_t v) { return 63 - std::countl_zero(static_cast<uint64_t>(v)); }
+    
+    int get_bucket_index(int64_t v) const
+    {
+      auto pow2_ceiling = 64 - std::countl_zero(static_cast<uint64_t>(v | sub_bucket_mask));
+      return pow2_ceiling - unit_magnitude - (sub_bucket_half_count_magnitude + 1);
+    }
+    
+    int64_t get_sub_bucket_index(int64_t v, int b_idx) const
+    {
+      return v >> (b_idx + unit_magnitude);
+    }
+    
+    size_t get_counts_index(int b_idx, int64_t sb_idx) const
+    {
+      return static_cast<size_t>(((static_cast<int64_t>(b_idx) + 1) << sub_bucket_half_count_magnitude)
+                                 + (sb_idx - sub_bucket_half_count));
+    }
+    
+    size_t get_counts_index(int64_t v) const
+    {
+      auto b_idx = get_bucket_index(v);
+      return get_counts_index(b_idx, get_sub_bucket_index(v, b_idx));
+    }
+    
+    int64_t value_from_index(int b_idx, int64_t sb_idx) const
+    {
+      return sb_idx << (b_idx + unit_magnitude);
+    }
+    
+    // Lowest value that maps to counts[c_idx].
+    int64_t value_at_index(size_t c_idx) const
+    {
+      auto b_idx = static_cast<int>(c_idx >> sub_bucket_half_count_magnitude) - 1;
+      auto sb_idx = static_cast<int64_t>(c_idx & (sub_bucket_half_count - 1)) + sub_bucket_half_count;
+      if (b_idx < 0)
+      {
+        sb_idx -= sub_bucket_half_count;
+        b_idx = 0;
+      }
+      return value_from_index(b_idx, sb_idx);
+    }
+
+  public:
+    // significant_digits is clamped to [1, 5].
+    HdrHistogram(int64_t lowest_discernible_value, int64_t highest_trackable_value, int num_significant_digits = 3)
+      : lowest_discernible(std::max<int64_t>(lowest_discernible_value, 1))
+      , highest_trackable(std::max(highest_trackable_value, 2*std::max<int64_t>(lowest_discernible_value, 1)))
+      , significant_digits(std::clamp(num_significant_digits, 1, 5))
+    {
+      int64_t largest_value_with_single_unit_resolution = 2;
+      for (int d = 0; d < significant_digits; ++d)
+        largest_value_with_single_unit_resolution *= 10;
+      
+      unit_magnitude = floor_log2(lowest_discernible);
+      auto sub_bucket_count_magnitude = floor_log2(largest_value_with_single_unit_resolution - 1) + 1;
+      sub_bucket_half_count_magnitude = std::max(sub_bucket_count_magnitude, 1) - 1;
+      sub_bucket_count = int64_t { 1 } << (sub_bucket_half_count_magnitude + 1);
+      sub_bucket_half_count = sub_bucket_count / 2;
+      sub_bucket_mask = (sub_bucket_count - 1) << unit_magnitude;
+      
+      // Number of power of two buckets needed to cover highest_trackable.
+      auto smallest_untrackable_value = sub_bucket_count << unit_magnitude;
+      bucket_count = 1;
+      while (smallest_untrackable_value <= highest_trackable)
+      {
+        bucket_count++;
+        if (smallest_untrackable_value > std::numeric_limits<int64_t>::max() / 2)
+          break;
+        smallest_untrackable_value <<= 1;
+      }
+      counts.resize(static_cast<size_t>(bucket_count + 1) * static_cast<size_t>(sub_bucket_half_count));
+    }
+    
+    void record(int64_t v, size_t count = 1)
+    {
+      if (v < 0)
+      {
+        num_underflow += count;
+        return;
+      }
+      if (v > highest_trackable)
+      {
+        num_overflow += count;
+        return;
+      }
+      counts[get_counts_index(v)] += count;
+      total_count += count;
+      math::minimize(min_value, v);
+      math::maximize(max_value, v);
+    }
+    
+    void operator+=(int64_t v) { record(v); }
+    
+    // Adds the counts of other. Each of its buckets is recorded at its lowest equivalent value,
+    //   so merging histograms with different layouts loses at most the coarser of the two precisions.
+    void merge(const HdrHistogram& other)
+    {
+      num_underflow += other.num_underflow;
+      num_overflow += other.num_overflow;
+      if (other.total_count == 0)
+        return;
+      if (other.unit_magnitude == unit_magnitude
+          && other.sub_bucket_half_count_magnitude == sub_bucket_half_count_magnitude
+          && other.counts.size() <= counts.size())
+      {
+        for (size_t c_idx = 0; c_idx < other.counts.size(); ++c_idx)
+          counts[c_idx] += other.counts[c_idx];
+        total_count += other.total_count;
+        math::minimize(min_value, other.min_value);
+        math::maximize(max_value, other.max_value);
+        return;
+      }
+      for (size_t c_idx = 0; c_idx < other.counts.size(); ++c_idx)
+        if (other.counts[c_idx] > 0)
+          record(other.value_at_index(c_idx), other.counts[c_idx]);
+    }
+    
+    void reset()
+    {
+      std::fill(counts.begin(), counts.end(), 0);
+      total_count = 0;
+      num_underflow = 0;
+      num_overflow = 0;
+      min_value = std::numeric_limits<int64_t>::max();
+      max_value = 0;
+    }
+    
+    // Width of the bucket containing v. Every value within it is reported as equivalent.
+    int64_t get_equivalent_range(int64_t v) const
+    {
+      auto b_idx = get_bucket_index(v);
+      auto sb_idx = get_sub_bucket_index(v, b_idx);
+      auto adjusted_b_idx = sb_idx >= sub_bucket_count ? b_idx + 1 : b_idx;
+      return int64_t { 1 } << (unit_magnitude + adjusted_b_idx);
+    }
+    
+    int64_t get_lowest_equivalent(int64_t v) const
+    {
+      auto b_idx = get_bucket_index(v);
+      return value_from_index(b_idx, get_sub_bucket_index(v, b_idx));
+    }
+    
+    int64_t get_highest_equivalent(int64_t v) const
+    {
+      return get_lowest_equivalent(v) + get_equivalent_range(v) - 1;
+    }
+    
+    int64_t get_median_equivalent(int64_t v) const
+    {
+      return get_lowest_equivalent(v) + get_equivalent_range(v) / 2;
+    }
+    
+    bool values_are_equivalent(int64_t v0, int64_t v1) const
+    {
+      return get_lowest_equivalent(v0) == get_lowest_equivalent(v1);
+    }
+    
+    // p in [0, 100], e.g. 50, 99 or 99.9.
+    // Returns the highest value equivalent to the sample at that rank, or 0 if empty.
+    int64_t get_value_at_percentile(double p) const
+    {
+      if (total_count == 0)
+        return 0;
+      p = std::clamp(p, 0.0, 100.0);
+      auto count_at_percentile = static_cast<size_t>(p / 100.0 * static_cast<double>(total_count) + 0.5);
+      count_at_percentile = std::max(count_at_percentile, 1_sz);
+      size_t cum = 0;
+      for (size_t c_idx = 0; c_idx < counts.size(); ++c_idx)
+      {
+        cum += counts[c_idx];
+        if (cum >= count_at_percentile)
+          return std::min(get_highest_equivalent(value_at_index(c_idx)), max_value);
+      }
+      return max_value;
+    }
+    
+    size_t get_count_at_value(int64_t v) const
+    {
+      if (v < 0 || v > highest_trackable)
+        return 0;
+      return counts[get_counts_index(v)];
+    }
+    
+    // Mean over the bucket medians.
+    double get_mean() const
+    {
+      if (total_count == 0)
+        return 0.0;
+      double sum = 0.0;
+      for (size_t c_idx = 0; c_idx < counts.size(); ++c_idx)
+        if (counts[c_idx] > 0)
+          sum += static_cast<double>(counts[c_idx]) * static_cast<double>(get_median_equivalent(value_at_index(c_idx)));
+      return sum / static_cast<double>(total_count);
+    }
+    
+    int64_t get_min() const { return total_count > 0 ? min_value : 0; }
+    int64_t get_max() const { return max_value; }
+    size_t get_total_count() const { return total_count; }
+    size_t get_num_underflow() const { return num_underflow; }
+    size_t get_num_overflow() const { return num_overflow; }
+    int64_t get_lowest_discernible() const { return lowest_discernible; }
+    int64_t get_highest_trackable() const { return highest_trackable; }
+    int get_significant_digits() const { return significant_digits; }
+    size_t get_num_counts() const { return counts.size(); }
+    
+    // Same bar chart as Histogram::to_stringbox(), but the nc columns are spaced logarithmically
+    //   between the lowest and highest recorded values, so that e.g. a 100 ns mode and a 10 ms tail
+    //   are both visible.
+    str::StringBox to_stringbox(int nr, int nc) const
+    {
+      std::vector<size_t> col_counts(static_cast<size_t>(std::max(nc, 1)), 0);
+      if (total_count > 0)
+      {
+        auto log_lo = std::log(static_cast<double>(get_lowest_equivalent(min_value)) + 1.0);
+        auto log_hi = std::log(static_cast<double>(get_highest_equivalent(max_value)) + 1.0);
+        auto inv_log_range = log_hi > log_lo ? col_counts.size() / (log_hi - log_lo) : 0.0;
+        auto last_col = static_cast<long>(col_counts.size()) - 1;
+        for (size_t c_idx = 0; c_idx < counts.size(); ++c_idx)
+        {
+          if (counts[c_idx] == 0)
+            continue;
+          auto v = static_cast<double>(get_median_equivalent(value_at_index(c_idx)));
+          auto col = static_cast<long>((std::log(v + 1.0) - log_lo) * inv_log_range);
+          col_counts[std::clamp(col, 0l, last_col)] += counts[c_idx];
+        }
+      }
+      return bars_to_stringbox(col_counts, nr, nc);
+    }
+  };
+
+}
@@ -7,6 +7,13 @@
 
 #pragma once
 #include "StringBox.h"
+#include "Utils.h"
+#include <optional>
+#include <span>
+#include <type_traits>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 
 constexpr std::size_t operator "" _sz(unsigned long long n) { return n; }
@@ -14,14 +21,48 @@ constexpr std::size_t operator "" _sz(unsigned long long n) { return n; }
 namespace hist
 {
 
+  // Renders one bar of '#' per column, scaled so that the largest count fills all nr rows.
+  str::StringBox bars_to_stringbox(const std::vector<size_t>& counts, int nr, int nc)
+  {
+    size_t max_num_samples = 0;
+    for (auto count : counts)
+      math::maximize(max_num_samples, count);
+    std::vector<int> hist_bars;
+    hist_bars.resize(nc);
+    for (int b_idx = 0; b_idx < nc && b_idx < static_cast<int>(counts.size()); ++b_idx)
+    {
+      auto t = max_num_samples > 0 ? static_cast<float>(counts[b_idx])/max_num_samples : 0.f;
+      hist_bars[b_idx] = std::round(t * nr);
+    }
+    str::StringBox sb(nr);
+    for (int r_idx = nr - 1; r_idx >= 0; --r_idx)
+    {
+      auto& str = sb[r_idx];
+      for (int c_idx = 0; c_idx < nc; ++c_idx)
+      {
+        if (nr - 1 - r_idx < hist_bars[c_idx])
+          str += '#';
+        else
+          str += ' ';
+      }
+    }
+    return sb;
+  }
+
   template<typename T>
   struct Buck
   {
+    // Only filled in when the histogram retains its samples.
     std::vector<T> samples;
+    size_t count = 0;
     T start = static_cast<T>(0);
     T end = static_cast<T>(0);
   };
 
+  // By default only a counter is kept per bucket, so memory does not grow with the number of samples.
+  // With retain_samples, every sample is also stored (once in the histogram and once in its bucket),
+  //   which makes resize() exact instead of redistributing the counts of the old buckets.
+  // Samples outside of [start, end] are counted as underflow / overflow.
   template<typename T>
   class Histogram
   {
@@ -30,103 +71,449 @@ namespace hist
     T range_start = static_cast<T>(0);
     T range_end = static_cast<T>(0);
     size_t num_buckets = 0;
+    bool retain_samples = false;
+    double inv_bucket_width = 0.0;
+    static constexpr size_t c_num_tally_lanes = 4;
+    // Samples whose bucket parameter is further than this from an integer are in bucket floor(param)
+    //   without the edge fix-up of bucket_index().
+    double fixup_param_eps = 0.0;
+    size_t num_underflow = 0;
+    size_t num_overflow = 0;
+    
+    struct CachedView
+    {
+      int nr = 0;
+      int nc = 0;
+      str::StringBox sb;
+    };
+    // Last rendered view. Cleared whenever the histogram changes.
+    mutable std::optional<CachedView> cached_view;
     
     void add_to_bucket(T s)
     {
-      auto t = math::value_to_param<float>(s, range_start, range_end);
-      auto param = t * static_cast<float>(num_buckets);
-      auto b_idx = static_cast<int>(param);
-      auto& buck = buckets[b_idx];
-      if (s < buck.start && b_idx > 0)
-        buckets[b_idx - 1].samples.emplace_back(s);
-      else if (s > buck.end && b_idx < static_cast<int>(num_buckets) - 1)
-        buckets[b_idx + 1].samples.emplace_back(s);
+      auto b_idx = bucket_index(s);
+      if (b_idx < 0)
+        num_underflow++;
+      else if (b_idx >= static_cast<long>(num_buckets))
+        num_overflow++;
       else
-        buck.samples.emplace_back(s);
+      {
+        auto& buck = buckets[b_idx];
+        buck.count++;
+        if (retain_samples)
+          buck.samples.emplace_back(s);
+      }
     }
     
-    void rebuild()
+    void rebuild_edges()
     {
-      T step = (range_end - range_start)/static_cast<T>(num_buckets);
-      T val_curr = range_start;
-      T val_prev = range_start;
-      int buck_idx = 0;
-      for (auto& buck : buckets)
-      {
-        val_prev = val_curr;
-        val_curr = val_curr + step;
-        if (buck_idx++ == static_cast<int>(num_buckets) - 1 && std::abs(val_curr - range_end) < 1e-4f)
-          val_curr = range_end;
-        buck.start = val_prev;
-        buck.end = val_curr;
+      auto range = static_cast<double>(range_end) - static_cast<double>(range_start);
+      inv_bucket_width = range > 0.0 ? static_cast<double>(num_buckets) / range : 0.0;
+      for (size_t b_idx = 0; b_idx < num_buckets; ++b_idx)
+      {
+        auto& buck = buckets[b_idx];
+        buck.start = b_idx == 0 ? range_start :
+          static_cast<T>(static_cast<double>(range_start) + range * static_cast<double>(b_idx) / num_buckets);
+        buck.end = b_idx == num_buckets - 1 ? range_end :
+          static_cast<T>(static_cast<double>(range_start) + range * static_cast<double>(b_idx + 1) / num_buckets);
       }
-      
-      auto num_samples = samples.size();
-      for (size_t s_idx = 0; s_idx < num_samples; ++s_idx)
+      // Largest distance between a bucket edge rounded to T and where the bucket parameter puts it,
+      //   plus margin for the rounding of the parameter itself.
+      fixup_param_eps = 0.0;
+      for (size_t b_idx = 1; b_idx < num_buckets; ++b_idx)
       {
-        auto s = samples[s_idx];
-        add_to_bucket(s);
+        auto param = (static_cast<double>(buckets[b_idx].start) - static_cast<double>(range_start)) * inv_bucket_width;
+        math::maximize(fixup_param_eps, std::abs(param - static_cast<double>(b_idx)));
       }
+      fixup_param_eps = 2.0*fixup_param_eps + 1e-9*static_cast<double>(num_buckets);
     }
     
+    // Calls visit(i, bucket_index(vals[i])) for every sample, in order.
+    //   Float samples are binned 8 (AVX2) or 4 (SSE2) at a time and double samples 4 at a time (AVX2)
+    //   by the bucket parameter alone. Only a group with a sample close to a bucket edge
+    //   (see fixup_param_eps) falls back to bucket_index(), which is rare.
+    template<typename Visit>
+    void visit_bucket_indices(std::span<const T> vals, Visit&& visit) const
+    {
+      size_t i = 0;
+      auto visit_one = [&](size_t idx)
+      {
+        visit(idx, bucket_index(vals[idx]));
+      };
+      // Visits the group of num_lanes samples at i with the bucket indices in lane_idx,
+      //   unless any of them is near an edge.
+      [[maybe_unused]] auto visit_group = [&](const int32_t* lane_idx, size_t num_lanes, bool near_edge)
+      {
+        for (size_t l = 0; l < num_lanes; ++l)
+        {
+          if (near_edge)
+            visit_one(i + l);
+          else
+            visit(i + l, static_cast<long>(lane_idx[l]));
+        }
+      };
+      [[maybe_unused]] const int N = static_cast<int>(num_buckets);
+      [[maybe_unused]] alignas(32) int32_t lane_idx[8];
+#if defined(__AVX2__)
+      if constexpr (std::is_same_v<T, float>)
+      {
+        // The parameter is computed in float, so allow for its rounding error too.
+        const float eps = static_cast<float>(fixup_param_eps + 4e-7 * N);
+        const __m256 v_start = _mm256_set1_ps(range_start);
+        const __m256 v_end = _mm256_set1_ps(range_end);
+        const __m256 v_inv = _mm256_set1_ps(static_cast<float>(inv_bucket_width));
+        const __m256 v_eps = _mm256_set1_ps(eps);
+        const __m256 v_one_eps = _mm256_set1_ps(1.f - eps);
+        const __m256 v_zero = _mm256_setzero_ps();
+        const __m256 v_last = _mm256_set1_ps(static_cast<float>(N - 1));
+        const __m256i v_under = _mm256_set1_epi32(-1);
+        const __m256i v_over = _mm256_set1_epi32(N);
+        for (; i + 8 <= vals.size(); i += 8)
+        {
+          auto s = _mm256_loadu_ps(vals.data() + i);
+          auto param = _mm256_mul_ps(_mm256_sub_ps(s, v_start), v_inv);
+          auto idx = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(param, v_zero), v_last));
+          auto idx_ps = _mm256_cvtepi32_ps(idx);
+          auto frac = _mm256_sub_ps(param, idx_ps);
+          auto near_start = _mm256_and_ps(_mm256_cmp_ps(frac, v_eps, _CMP_LT_OQ), _mm256_cmp_ps(idx_ps, v_zero, _CMP_GT_OQ));
+          auto near_end = _mm256_and_ps(_mm256_cmp_ps(frac, v_one_eps, _CMP_GT_OQ), _mm256_cmp_ps(idx_ps, v_last, _CMP_LT_OQ));
+          idx = _mm256_blendv_epi8(idx, v_under, _mm256_castps_si256(_mm256_cmp_ps(s, v_start, _CMP_LT_OQ)));
+          idx = _mm256_blendv_epi8(idx, v_over, _mm256_castps_si256(_mm256_cmp_ps(s, v_end, _CMP_GT_OQ)));
+          _mm256_store_si256(reinterpret_cast<__m256i*>(lane_idx), idx);
+          visit_group(lane_idx, 8, _mm256_movemask_ps(_mm256_or_ps(near_start, near_end)) != 0);
+        }
+      }
+      else if constexpr (std::is_same_v<T, double>)
+      {
+        const __m256d v_start = _mm256_set1_pd(range_start);
+        const __m256d v_end = _mm256_set1_pd(range_end);
+        const __m256d v_inv = _mm256_set1_pd(inv_bucket_width);
+        const __m256d v_eps = _mm256_set1_pd(fixup_param_eps);
+        const __m256d v_one_eps = _mm256_set1_pd(1.0 - fixup_param_eps);
+        const __m256d v_zero = _mm256_setzero_pd();
+        const __m256d v_last = _mm256_set1_pd(N - 1);
+        const __m128i v_under = _mm_set1_epi32(-1);
+        const __m128i v_over = _mm_set1_epi32(N);
+        // Picks the low 32 bits of each 64 bit compare mask.
+        const __m256i v_pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+        auto pack_mask = [&v_pack](__m256d m)
+        {
+          return _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(m), v_pack));
+        };
+        for (; i + 4 <= vals.size(); i += 4)
+        {
+          auto s = _mm256_loadu_pd(vals.data() + i);
+          auto param = _mm256_mul_pd(_mm256_sub_pd(s, v_start), v_inv);
+          auto idx = _mm256_cvttpd_epi32(_mm256_min_pd(_mm256_max_pd(param, v_zero), v_last));
+          auto idx_pd = _mm256_cvtepi32_pd(idx);
+          auto frac = _mm256_sub_pd(param, idx_pd);
+          auto near_start = _mm256_and_pd(_mm256_cmp_pd(frac, v_eps, _CMP_LT_OQ), _mm256_cmp_pd(idx_pd, v_zero, _CMP_GT_OQ));
+          auto near_end = _mm256_and_pd(_mm256_cmp_pd(frac, v_one_eps, _CMP_GT_OQ), _mm256_cmp_pd(idx_pd, v_last, _CMP_LT_OQ));
+          idx = _mm_blendv_epi8(idx, v_under, pack_mask(_mm256_cmp_pd(s, v_start, _CMP_LT_OQ)));
+          idx = _mm_blendv_epi8(idx, v_over, pack_mask(_mm256_cmp_pd(s, v_end, _CMP_GT_OQ)));
+          _mm_store_si128(reinterpret_cast<__m128i*>(lane_idx), idx);
+          visit_group(lane_idx, 4, _mm256_movemask_pd(_mm256_or_pd(near_start, near_end)) != 0);
+        }
+      }
+#elif defined(__SSE2__)
+      if constexpr (std::is_same_v<T, float>)
+      {
+        // The parameter is computed in float, so allow for its rounding error too.
+        const float eps = static_cast<float>(fixup_param_eps + 4e-7 * N);
+        const __m128 v_start = _mm_set1_ps(range_start);
+        const __m128 v_end = _mm_set1_ps(range_end);
+        const __m128 v_inv = _mm_set1_ps(static_cast<float>(inv_bucket_width));
+        const __m128 v_eps = _mm_set1_ps(eps);
+        const __m128 v_one_eps = _mm_set1_ps(1.f - eps);
+        const __m128 v_zero = _mm_setzero_ps();
+        const __m128 v_last = _mm_set1_ps(static_cast<float>(N - 1));
+        const __m128i v_under = _mm_set1_epi32(-1);
+        const __m128i v_over = _mm_set1_epi32(N);
+        // SSE2 has no blendv.
+        auto select = [](__m128i mask, __m128i a, __m128i b)
+        {
+          return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+        };
+        for (; i + 4 <= vals.size(); i += 4)
+        {
+          auto s = _mm_loadu_ps(vals.data() + i);
+          auto param = _mm_mul_ps(_mm_sub_ps(s, v_start), v_inv);
+          auto idx = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(param, v_zero), v_last));
+          auto idx_ps = _mm_cvtepi32_ps(idx);
+          auto frac = _mm_sub_ps(param, idx_ps);
+          auto near_start = _mm_and_ps(_mm_cmplt_ps(frac, v_eps), _mm_cmpgt_ps(idx_ps, v_zero));
+          auto near_end = _mm_and_ps(_mm_cmpgt_ps(frac, v_one_eps), _mm_cmplt_ps(idx_ps, v_last));
+          idx = select(_mm_castps_si128(_mm_cmplt_ps(s, v_start)), v_under, idx);
+          idx = select(_mm_castps_si128(_mm_cmpgt_ps(s, v_end)), v_over, idx);
+          _mm_store_si128(reinterpret_cast<__m128i*>(lane_idx), idx);
+          visit_group(lane_idx, 4, _mm_movemask_ps(_mm_or_ps(near_start, near_end)) != 0);
+        }
+      }
+#endif
+      for (; i < vals.size(); ++i)
+        visit_one(i);
+    }
+    
+    // Counts vals into tally, where slot 0 is underflow and slot num_buckets + 1 is overflow.
+    // tally holds c_num_tally_lanes tables of num_buckets + 2 slots, so that runs of samples
+    //   in the same bucket do not wait on each other's increments. They are summed by the caller.
+    void tally_samples(std::span<const T> vals, std::vector<size_t>& tally) const
+    {
+      const size_t stride = num_buckets + 2;
+      visit_bucket_indices(vals, [&](size_t idx, long b_idx)
+      {
+        tally[(idx % c_num_tally_lanes)*stride + b_idx + 1]++;
+      });
+    }
+    
+    void rebuild()
+    {
+      rebuild_edges();
+      
+      num_underflow = 0;
+      num_overflow = 0;
+      for (const auto& s : samples)
+        add_to_bucket(s);
+    }
+    
+    void invalidate_view() { cached_view.reset(); }
+    
   public:
-    Histogram(size_t N_buck, T start, T end)
+    Histogram(size_t N_buck, T start, T end, bool retain_exact_samples = false)
       : range_start(start), range_end(end), num_buckets(std::max(N_buck, 1_sz))
+      , retain_samples(retain_exact_samples)
     {
       buckets.resize(num_buckets);
       
       rebuild();
     }
     
+    // Returns -1 for samples below the range and num_buckets for samples above it.
+    long bucket_index(T s) const
+    {
+      if (s < range_start)
+        return -1;
+      if (s > range_end)
+        return static_cast<long>(num_buckets);
+      auto param = (static_cast<double>(s) - static_cast<double>(range_start)) * inv_bucket_width;
+      auto b_idx = std::min(static_cast<long>(param), static_cast<long>(num_buckets) - 1);
+      // Bucket edges are rounded to T independently of param, so fix up the edge cases.
+      const auto& buck = buckets[b_idx];
+      if (s < buck.start && b_idx > 0)
+        b_idx--;
+      else if (s > buck.end && b_idx < static_cast<long>(num_buckets) - 1)
+        b_idx++;
+      return b_idx;
+    }
+    
+    // bucket_index() of each of vals into the same position of idx, which must be at least as long.
+    //   Binned in SIMD lanes like add_samples().
+    void bucket_indices(std::span<const T> vals, std::span<long> idx) const
+    {
+      visit_bucket_indices(vals, [&idx](size_t i, long b_idx) { idx[i] = b_idx; });
+    }
+    
     void operator+=(T val)
     {
-      samples.emplace_back(val);
+      invalidate_view();
+      if (retain_samples)
+        samples.emplace_back(val);
       add_to_bucket(val);
     }
     
-    void resize(size_t N_buck, T start, T end)
+    // Bulk version of operator+=. Bins into a contiguous tally first and only then adds to the buckets.
+    //   Float and double samples are binned in SIMD lanes (AVX2 if enabled, e.g. with -mavx2, else SSE2).
+    void add_samples(std::span<const T> vals)
     {
-      num_buckets = std::max(N_buck, 1_sz);
-      range_start = start;
-      range_end = end;
-
-      buckets.clear();
-      buckets.resize(num_buckets);
-      
-      rebuild();
+      if (vals.empty())
+        return;
+      invalidate_view();
+      if (retain_samples)
+        samples.insert(samples.end(), vals.begin(), vals.end());
+      const size_t stride = num_buckets + 2;
+      // Small batches are not worth setting up the tally for.
+      if (retain_samples || vals.size() < c_num_tally_lanes * stride)
+      {
+        for (const auto& s : vals)
+          add_to_bucket(s);
+        return;
+      }
+      std::vector<size_t> tally(c_num_tally_lanes * stride, 0);
+      tally_samples(vals, tally);
+      for (size_t l = 1; l < c_num_tally_lanes; ++l)
+        for (size_t c_idx = 0; c_idx < stride; ++c_idx)
+          tally[c_idx] += tally[l*stride + c_idx];
+      num_underflow += tally[0];
+      for (size_t b_idx = 0; b_idx < num_buckets; ++b_idx)
+        buckets[b_idx].count += tally[b_idx + 1];
+      num_overflow += tally[num_buckets + 1];
     }
     
-    str::StringBox to_stringbox(int nr, int nc)
+    // With retained samples the samples are re-bucketed exactly. Count-only histograms are re-binned
+    //   with rebin_counts(), which is approximate unless the new buckets are unions of the current ones,
+    //   so resizing back and forth can move counts between neighbouring buckets.
+    void resize(size_t N_buck, T start, T end)
     {
-      auto hist = *this;
-      hist.resize(nc, range_start, range_end);
-      size_t max_num_samples = 0;
-      for (const auto& buck : hist.buckets)
-        math::maximize(max_num_samples, buck.samples.size());
-      std::vector<int> hist_bars;
-      hist_bars.resize(nc);
-      for (int b_idx = 0; b_idx < static_cast<int>(hist.num_buckets); ++b_idx)
+      invalidate_view();
+      N_buck = std::max(N_buck, 1_sz);
+      
+      if (retain_samples)
       {
-        const auto& buck = hist.buckets[b_idx];
-        auto t = static_cast<float>(buck.samples.size())/max_num_samples;
-        hist_bars[b_idx] = std::round(t * nr);
+        num_buckets = N_buck;
+        range_start = start;
+        range_end = end;
+        buckets.clear();
+        buckets.resize(num_buckets);
+        
+        rebuild();
       }
-      str::StringBox sb(nr);
-      for (int r_idx = nr - 1; r_idx >= 0; --r_idx)
+      else
+      {
+        auto counts = rebin_counts(N_buck, start, end, &num_underflow, &num_overflow);
+        num_buckets = N_buck;
+        range_start = start;
+        range_end = end;
+        buckets.clear();
+        buckets.resize(num_buckets);
+        rebuild_edges();
+        for (size_t b_idx = 0; b_idx < num_buckets; ++b_idx)
+          buckets[b_idx].count = counts[b_idx];
+      }
+    }
+    
+    // Derives the bucket counts of another bucket layout from the current bucket counts alone,
+    //   in O(number of buckets) regardless of the number of samples.
+    // Counts of the current buckets are spread proportionally to the overlap, i.e. samples are assumed
+    //   to be uniformly distributed within each bucket. This is exact when the new buckets are unions
+    //   of the current ones (e.g. N_buck divides the current number of buckets over the same range).
+    //   Rounding is done on the cumulative counts, so the total count is preserved.
+    //   Otherwise the counts are an approximation, even when samples are retained, since they are never read here.
+    // Underflow / overflow include the current ones plus what falls outside of the new range.
+    std::vector<size_t> rebin_counts(size_t N_buck, T start, T end,
+                                     size_t* underflow = nullptr, size_t* overflow = nullptr) const
+    {
+      N_buck = std::max(N_buck, 1_sz);
+      std::vector<double> new_counts(N_buck, 0.0);
+      auto under = static_cast<double>(num_underflow);
+      auto over = static_cast<double>(num_overflow);
+      auto new_start = static_cast<double>(start);
+      auto new_end = static_cast<double>(end);
+      auto new_width = (new_end - new_start) / N_buck;
+      auto N = static_cast<long>(N_buck);
+      for (const auto& buck : buckets)
       {
-        auto& str = sb[r_idx];
-        for (int c_idx = 0; c_idx < nc; ++c_idx)
+        if (buck.count == 0)
+          continue;
+        auto b_start = static_cast<double>(buck.start);
+        auto b_end = static_cast<double>(buck.end);
+        auto count = static_cast<double>(buck.count);
+        if (b_end <= b_start || new_width <= 0.0)
         {
-          if (nr - 1 - r_idx < hist_bars[c_idx])
-            str += '#';
+          // Degenerate bucket or range: all of it lands where the bucket starts.
+          if (b_start < new_start)
+            under += count;
+          else if (b_start > new_end)
+            over += count;
           else
-            str += ' ';
+            new_counts[new_width > 0.0 ? std::min(static_cast<long>((b_start - new_start) / new_width), N - 1) : 0] += count;
+          continue;
         }
+        auto density = count / (b_end - b_start);
+        if (b_start < new_start)
+          under += density * (std::min(b_end, new_start) - b_start);
+        if (b_end > new_end)
+          over += density * (b_end - std::max(b_start, new_end));
+        auto lo = std::max(b_start, new_start);
+        auto hi = std::min(b_end, new_end);
+        for (auto nb_idx = std::min(static_cast<long>((lo - new_start) / new_width), N - 1); lo < hi && nb_idx < N; ++nb_idx)
+        {
+          auto nb_start = new_start + nb_idx * new_width;
+          auto nb_end = nb_idx == N - 1 ? new_end : nb_start + new_width;
+          if (nb_start >= hi)
+            break;
+          auto overlap = std::min(nb_end, hi) - std::max(nb_start, lo);
+          if (overlap > 0.0)
+            new_counts[nb_idx] += density * overlap;
+        }
+      }
+      
+      std::vector<size_t> counts(N_buck, 0);
+      double cum = under;
+      auto rounded_under = static_cast<size_t>(std::llround(cum));
+      auto prev_rounded = rounded_under;
+      for (size_t nb_idx = 0; nb_idx < N_buck; ++nb_idx)
+      {
+        cum += new_counts[nb_idx];
+        auto rounded = static_cast<size_t>(std::llround(cum));
+        counts[nb_idx] = rounded - prev_rounded;
+        prev_rounded = rounded;
       }
+      cum += over;
+      utils::try_set(underflow, rounded_under);
+      utils::try_set(overflow, static_cast<size_t>(std::llround(cum)) - prev_rounded);
+      return counts;
+    }
+    
+    // Adds counts[b_idx] samples to each bucket, e.g. from a recorder with the same bucket layout.
+    // Only possible for count-only histograms, since there are no samples to retain.
+    bool add_counts(const std::vector<size_t>& counts, size_t underflow = 0, size_t overflow = 0)
+    {
+      if (retain_samples || counts.size() != num_buckets)
+        return false;
+      invalidate_view();
+      for (size_t b_idx = 0; b_idx < num_buckets; ++b_idx)
+        buckets[b_idx].count += counts[b_idx];
+      num_underflow += underflow;
+      num_overflow += overflow;
+      return true;
+    }
+    
+    size_t get_num_buckets() const { return num_buckets; }
+    T get_range_start() const { return range_start; }
+    T get_range_end() const { return range_end; }
+    const Buck<T>& get_bucket(size_t b_idx) const { return buckets[b_idx]; }
+    size_t get_count(size_t b_idx) const { return buckets[b_idx].count; }
+    size_t get_num_underflow() const { return num_underflow; }
+    size_t get_num_overflow() const { return num_overflow; }
+    bool retains_samples() const { return retain_samples; }
+    
+    // Total number of samples added, including those outside of the range.
+    size_t get_num_samples() const
+    {
+      size_t num = num_underflow + num_overflow;
+      for (const auto& buck : buckets)
+        num += buck.count;
+      return num;
+    }
+    
+    // With retained samples the bars re-bucket the samples exactly into nc columns.
+    //   Count-only histograms derive them with rebin_counts() instead, in O(number of buckets),
+    //   which is approximate unless the columns are unions of the buckets.
+    //   The rendered box is cached until the histogram changes.
+    str::StringBox to_stringbox(int nr, int nc) const
+    {
+      if (cached_view.has_value() && cached_view->nr == nr && cached_view->nc == nc)
+        return cached_view->sb;
+      
+      auto num_cols = static_cast<size_t>(std::max(nc, 1));
+      std::vector<size_t> counts;
+      if (retain_samples)
+      {
+        Histogram<T> cols(num_cols, range_start, range_end);
+        cols.add_samples(samples);
+        counts.resize(num_cols);
+        for (size_t c_idx = 0; c_idx < num_cols; ++c_idx)
+          counts[c_idx] = cols.get_count(c_idx);
+      }
+      else
+        counts = rebin_counts(num_cols, range_start, range_end);
+      auto sb = bars_to_stringbox(counts, nr, nc);
+      cached_view = CachedView { nr, nc, sb };
       return sb;
     }
     
     // Returns number of samples in the wrong bucket.
+    // Only meaningful when samples are retained.
     int sanity_check_bucket_samples() const
     {
       int num_outside = 0;
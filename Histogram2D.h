@@ -0,0 +1,183 @@
+//
+//  Histogram2D.h
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Histogram.h"
+
+
+namespace hist
+{
+
+  // Counts (x, y) pairs in a grid of N_x by N_y buckets, e.g. for heatmaps of simulation output.
+  // All counters live in one contiguous row-major vector (one row per y bucket). It is padded with an
+  //   underflow and an overflow row and column, so that samples outside of the range in one coordinate
+  //   still count towards the marginal of the other and the marginals are exact.
+  // The bucket edges along each axis are the same as those of a Histogram<T> with that range.
+  template<typename T>
+  class Histogram2D
+  {
+    // Empty, count-only histograms that only provide the bucket layout along each axis.
+    Histogram<T> x_layout;
+    Histogram<T> y_layout;
+    size_t num_buckets_x = 0;
+    size_t num_buckets_y = 0;
+    size_t stride = 0;
+    std::vector<size_t> counts;
+    
+    // Index into counts from bucket indices in [-1, num_buckets].
+    size_t cell_index(long x_idx, long y_idx) const
+    {
+      return static_cast<size_t>(y_idx + 1) * stride + static_cast<size_t>(x_idx + 1);
+    }
+
+  public:
+    Histogram2D(size_t N_buck_x, T x_start, T x_end, size_t N_buck_y, T y_start, T y_end)
+      : x_layout(N_buck_x, x_start, x_end), y_layout(N_buck_y, y_start, y_end)
+      , num_buckets_x(x_layout.get_num_buckets()), num_buckets_y(y_layout.get_num_buckets())
+      , stride(num_buckets_x + 2)
+    {
+      counts.resize(stride * (num_buckets_y + 2), 0);
+    }
+    
+    void add(T x, T y)
+    {
+      counts[cell_index(x_layout.bucket_index(x), y_layout.bucket_index(y))]++;
+    }
+    
+    // Adds the pairs (xs[i], ys[i]). Only the first min(xs.size(), ys.size()) pairs are used.
+    //   The x and y bucket indices are computed in blocks with the SIMD binning of Histogram::bucket_indices().
+    void add_samples(std::span<const T> xs, std::span<const T> ys)
+    {
+      const size_t c_block_size = 256;
+      long x_idcs[c_block_size];
+      long y_idcs[c_block_size];
+      auto num = std::min(xs.size(), ys.size());
+      for (size_t i = 0; i < num; i += c_block_size)
+      {
+        auto n = std::min(c_block_size, num - i);
+        x_layout.bucket_indices(xs.subspan(i, n), x_idcs);
+        y_layout.bucket_indices(ys.subspan(i, n), y_idcs);
+        for (size_t j = 0; j < n; ++j)
+          counts[cell_index(x_idcs[j], y_idcs[j])]++;
+      }
+    }
+    
+    void clear()
+    {
+      std::fill(counts.begin(), counts.end(), 0);
+    }
+    
+    size_t get_num_buckets_x() const { return num_buckets_x; }
+    size_t get_num_buckets_y() const { return num_buckets_y; }
+    const Buck<T>& get_bucket_x(size_t x_idx) const { return x_layout.get_bucket(x_idx); }
+    const Buck<T>& get_bucket_y(size_t y_idx) const { return y_layout.get_bucket(y_idx); }
+    
+    size_t get_count(size_t x_idx, size_t y_idx) const
+    {
+      return counts[cell_index(static_cast<long>(x_idx), static_cast<long>(y_idx))];
+    }
+    
+    // Number of samples outside of the grid in either coordinate.
+    size_t get_num_outside() const
+    {
+      return get_num_samples() - get_num_inside();
+    }
+    
+    size_t get_num_inside() const
+    {
+      size_t num = 0;
+      for (size_t y_idx = 0; y_idx < num_buckets_y; ++y_idx)
+        for (size_t x_idx = 0; x_idx < num_buckets_x; ++x_idx)
+          num += get_count(x_idx, y_idx);
+      return num;
+    }
+    
+    size_t get_num_samples() const
+    {
+      size_t num = 0;
+      for (auto c : counts)
+        num += c;
+      return num;
+    }
+    
+    // Histogram of the x coordinates of all samples, including those with y outside of the range.
+    Histogram<T> marginal_x() const
+    {
+      std::vector<size_t> col_counts(stride, 0);
+      for (size_t row = 0; row < num_buckets_y + 2; ++row)
+        for (size_t col = 0; col < stride; ++col)
+          col_counts[col] += counts[row * stride + col];
+      Histogram<T> marginal(num_buckets_x, x_layout.get_range_start(), x_layout.get_range_end());
+      marginal.add_counts(std::vector<size_t>(col_counts.begin() + 1, col_counts.end() - 1),
+                          col_counts.front(), col_counts.back());
+      return marginal;
+    }
+    
+    // Histogram of the y coordinates of all samples, including those with x outside of the range.
+    Histogram<T> marginal_y() const
+    {
+      std::vector<size_t> row_counts(num_buckets_y + 2, 0);
+      for (size_t row = 0; row < num_buckets_y + 2; ++row)
+        for (size_t col = 0; col < stride; ++col)
+          row_counts[row] += counts[row * stride + col];
+      Histogram<T> marginal(num_buckets_y, y_layout.get_range_start(), y_layout.get_range_end());
+      marginal.add_counts(std::vector<size_t>(row_counts.begin() + 1, row_counts.end() - 1),
+                          row_counts.front(), row_counts.back());
+      return marginal;
+    }
+    
+    // Heatmap of the samples inside of the grid with y growing upwards.
+    // Each of the nr x nc characters sums the buckets that fall into it, or shows the bucket it falls into
+    //   when the grid has fewer buckets than characters along an axis, and is picked from a density ramp,
+    //   from ' ' for empty to '@' for the fullest character.
+    str::StringBox to_stringbox(int nr, int nc) const
+    {
+      static const std::string ramp = " .:-=+*#%@";
+      nr = std::max(nr, 1);
+      nc = std::max(nc, 1);
+      // Each character sums the buckets [c_idx * N / nc, (c_idx + 1) * N / nc) along each axis,
+      //   or repeats the single bucket c_idx * N / nc when there are more characters than buckets.
+      auto bucket_range = [](int cell, int num_cells, size_t num_buckets)
+      {
+        auto first = static_cast<size_t>(cell) * num_buckets / num_cells;
+        auto last = static_cast<size_t>(cell + 1) * num_buckets / num_cells;
+        return std::pair { first, std::max(last, first + 1) };
+      };
+      std::vector<size_t> cells(static_cast<size_t>(nr) * nc, 0);
+      for (int r_idx = 0; r_idx < nr; ++r_idx)
+      {
+        auto [y_first, y_last] = bucket_range(nr - 1 - r_idx, nr, num_buckets_y);
+        for (int c_idx = 0; c_idx < nc; ++c_idx)
+        {
+          auto [x_first, x_last] = bucket_range(c_idx, nc, num_buckets_x);
+          auto& cell = cells[r_idx * nc + c_idx];
+          for (auto y_idx = y_first; y_idx < y_last; ++y_idx)
+            for (auto x_idx = x_first; x_idx < x_last; ++x_idx)
+              cell += get_count(x_idx, y_idx);
+        }
+      }
+      size_t max_count = 0;
+      for (auto c : cells)
+        math::maximize(max_count, c);
+      str::StringBox sb(nr);
+      for (int r_idx = 0; r_idx < nr; ++r_idx)
+      {
+        auto& str = sb[r_idx];
+        for (int c_idx = 0; c_idx < nc; ++c_idx)
+        {
+          auto c = cells[r_idx * nc + c_idx];
+          size_t level = 0;
+          if (c > 0)
+            level = 1 + (c * (ramp.size() - 2) + max_count / 2) / max_count;
+          str += ramp[std::min(level, ramp.size() - 1)];
+        }
+      }
+      return sb;
+    }
+  };
+
+}
@@ -0,0 +1,150 @@
+//
+//  MappedFile.h
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+namespace mapped_file
+{
+
+  // Read-only memory mapping of a whole file. The pages are loaded by the OS on demand,
+  //   so opening even a multi-gigabyte file is instant and does not copy it into the heap.
+  // An empty file opens fine with size() == 0 and data() == nullptr.
+  class MappedFile
+  {
+    const char* ptr = nullptr;
+    size_t num_bytes = 0;
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+
+  public:
+    MappedFile() = default;
+    MappedFile(const std::string& file_path) { open(file_path); }
+    ~MappedFile() { close(); }
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+      if (this != &other)
+      {
+        close();
+        ptr = std::exchange(other.ptr, nullptr);
+        num_bytes = std::exchange(other.num_bytes, 0);
+        opened = std::exchange(other.opened, false);
+#ifdef _WIN32
+        file_handle = std::exchange(other.file_handle, INVALID_HANDLE_VALUE);
+        mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+      }
+      return *this;
+    }
+    
+    // Returns false if the file could not be opened or mapped.
+    bool open(const std::string& file_path)
+    {
+      close();
+#ifdef _WIN32
+      file_handle = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (file_handle == INVALID_HANDLE_VALUE)
+        return false;
+      LARGE_INTEGER file_size;
+      if (!GetFileSizeEx(file_handle, &file_size))
+      {
+        close();
+        return false;
+      }
+      num_bytes = static_cast<size_t>(file_size.QuadPart);
+      if (num_bytes > 0)
+      {
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping_handle == nullptr)
+        {
+          close();
+          return false;
+        }
+        ptr = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        if (ptr == nullptr)
+        {
+          close();
+          return false;
+        }
+      }
+#else
+      int fd = ::open(file_path.c_str(), O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat st;
+      if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+      {
+        ::close(fd);
+        return false;
+      }
+      num_bytes = static_cast<size_t>(st.st_size);
+      if (num_bytes > 0)
+      {
+        void* addr = mmap(nullptr, num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+          ::close(fd);
+          num_bytes = 0;
+          return false;
+        }
+        madvise(addr, num_bytes, MADV_SEQUENTIAL);
+        ptr = static_cast<const char*>(addr);
+      }
+      // The mapping stays valid after the descriptor is closed.
+      ::close(fd);
+#endif
+      opened = true;
+      return true;
+    }
+    
+    void close()
+    {
+#ifdef _WIN32
+      if (ptr != nullptr)
+        UnmapViewOfFile(ptr);
+      if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+      if (file_handle != INVALID_HANDLE_VALUE)
+        CloseHandle(file_handle);
+      mapping_handle = nullptr;
+      file_handle = INVALID_HANDLE_VALUE;
+#else
+      if (ptr != nullptr)
+        munmap(const_cast<char*>(ptr), num_bytes);
+#endif
+      ptr = nullptr;
+      num_bytes = 0;
+      opened = false;
+    }
+    
+    bool is_open() const { return opened; }
+    const char* data() const { return ptr; }
+    size_t size() const { return num_bytes; }
+    std::string_view view() const { return { ptr, num_bytes }; }
+  };
+
+}
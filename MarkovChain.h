@@ -7,155 +7,1200 @@
 
 #pragma once
 #include <map>
+#include <unordered_map>
 #include <vector>
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <fstream>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <memory>
+#include <cstring>
+#include <type_traits>
+#include <optional>
 #include "Rand.h"
+#include "Utils.h"
+#include "MappedFile.h"
 
 namespace markov_chain
 {
 
+  namespace detail
+  {
+  
+    // fmix64 from MurmurHash3.
+    uint64_t mix64(uint64_t key)
+    {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdull;
+      key ^= key >> 33;
+      key *= 0xc4ceb9fe1a85ec53ull;
+      key ^= key >> 33;
+      return key;
+    }
+    
+    // Uniform index in [0, N) from the 32 high bits of a 64-bit engine, by Lemire's multiply-and-reject.
+    //   Unlike scaling a float, every index stays reachable for N beyond 2^24.
+    template<typename Engine>
+    uint32_t rand_index(Engine& engine, uint32_t N)
+    {
+      auto m = (engine() >> 32) * N;
+      if (static_cast<uint32_t>(m) < N)
+      {
+        auto threshold = (0u - N) % N;
+        while (static_cast<uint32_t>(m) < threshold)
+          m = (engine() >> 32) * N;
+      }
+      return static_cast<uint32_t>(m >> 32);
+    }
+    
+    // Uniform float in [0, 1) from 24 bits of a 64-bit engine.
+    template<typename Engine>
+    float rand_unit(Engine& engine)
+    {
+      return static_cast<float>(engine() >> 40) * 0x1p-24f;
+    }
+    
+    // Open addressing (linear probing) hash table from 64 bit keys to counts, for the transition counts.
+    //   Unlike std::unordered_map it does one allocation per rehash rather than one per key,
+    //   and a lookup usually touches a single cache line.
+    // The all-ones key is reserved to mark empty slots.
+    class FlatCountTable
+    {
+      static constexpr uint64_t c_empty_key = ~uint64_t { 0 };
+      std::vector<std::pair<uint64_t, uint64_t>> slots;
+      size_t num_keys = 0;
+      size_t mask = 0;
+      
+      void rehash(size_t num_slots)
+      {
+        std::vector<std::pair<uint64_t, uint64_t>> old_slots(num_slots, { c_empty_key, 0 });
+        old_slots.swap(slots);
+        mask = num_slots - 1;
+        for (const auto& slot : old_slots)
+          if (slot.first != c_empty_key)
+          {
+            auto s_idx = mix64(slot.first) & mask;
+            while (slots[s_idx].first != c_empty_key)
+              s_idx = (s_idx + 1) & mask;
+            slots[s_idx] = slot;
+          }
+      }
+      
+    public:
+      // Count of key, inserted as zero if missing.
+      uint64_t& operator[](uint64_t key)
+      {
+        // Keep the load factor at most 1/2.
+        if (2 * (num_keys + 1) > slots.size())
+          rehash(std::max<size_t>(16, slots.size() * 2));
+        auto s_idx = mix64(key) & mask;
+        while (true)
+        {
+          auto& slot = slots[s_idx];
+          if (slot.first == key)
+            return slot.second;
+          if (slot.first == c_empty_key)
+          {
+            slot.first = key;
+            num_keys++;
+            return slot.second;
+          }
+          s_idx = (s_idx + 1) & mask;
+        }
+      }
+      
+      size_t size() const { return num_keys; }
+      
+      // Calls f(key, count) for every key, in no particular order.
+      template<typename Func>
+      void for_each(Func f) const
+      {
+        for (const auto& slot : slots)
+          if (slot.first != c_empty_key)
+            f(slot.first, slot.second);
+      }
+    };
+    
+    // Interns n-grams of a fixed order (sequences of that many 32 bit ids) to dense ids.
+    // The n-grams are stored back to back in one vector, and the open addressing (linear probing) slots
+    //   only hold n-gram ids, so memory is order * 4 bytes per n-gram plus at most 8 bytes of slots.
+    class NGramTable
+    {
+      static constexpr uint32_t c_empty_slot = ~uint32_t { 0 };
+      size_t order = 1;
+      std::vector<uint32_t> ngrams;
+      std::vector<uint32_t> slots;
+      size_t mask = 0;
+      std::vector<uint32_t> shift_buffer;
+      // For order 1, the n-gram id of each id, as shift() is then a plain lookup.
+      std::vector<uint32_t> unigram_ids;
+      
+      uint64_t hash(const uint32_t* ngram) const
+      {
+        uint64_t h = 0;
+        for (size_t k = 0; k < order; ++k)
+          h = mix64(h + ngram[k] + 0x9e3779b97f4a7c15ull);
+        return h;
+      }
+      
+      bool equals(uint32_t id, const uint32_t* ngram) const
+      {
+        return std::equal(ngram, ngram + order, ngrams.begin() + static_cast<size_t>(id) * order);
+      }
+      
+      void rehash(size_t num_slots)
+      {
+        slots.assign(num_slots, c_empty_slot);
+        mask = num_slots - 1;
+        for (uint32_t id = 0; id < static_cast<uint32_t>(size()); ++id)
+        {
+          auto s_idx = hash(get(id)) & mask;
+          while (slots[s_idx] != c_empty_slot)
+            s_idx = (s_idx + 1) & mask;
+          slots[s_idx] = id;
+        }
+      }
+      
+    public:
+      static constexpr uint32_t npos = ~uint32_t { 0 };
+      
+      NGramTable(size_t n = 1) : order(std::max<size_t>(n, 1)) {}
+      
+      // Id of the n-gram of order ids starting at ngram, or npos.
+      uint32_t find(const uint32_t* ngram) const
+      {
+        if (slots.empty())
+          return npos;
+        auto s_idx = hash(ngram) & mask;
+        while (slots[s_idx] != c_empty_slot)
+        {
+          if (equals(slots[s_idx], ngram))
+            return slots[s_idx];
+          s_idx = (s_idx + 1) & mask;
+        }
+        return npos;
+      }
+      
+      // Like find(), but adds the n-gram with the next free id if missing.
+      uint32_t intern(const uint32_t* ngram)
+      {
+        // Keep the load factor at most 1/2.
+        if (2 * (size() + 1) > slots.size())
+          rehash(std::max<size_t>(16, slots.size() * 2));
+        auto s_idx = hash(ngram) & mask;
+        while (slots[s_idx] != c_empty_slot)
+        {
+          if (equals(slots[s_idx], ngram))
+            return slots[s_idx];
+          s_idx = (s_idx + 1) & mask;
+        }
+        auto id = static_cast<uint32_t>(size());
+        slots[s_idx] = id;
+        ngrams.insert(ngrams.end(), ngram, ngram + order);
+        return id;
+      }
+      
+      // Interns the n-gram of the last order - 1 ids of n-gram id followed by next,
+      //   i.e. the context after next in a Markov chain.
+      uint32_t shift(uint32_t id, uint32_t next)
+      {
+        if (order == 1)
+        {
+          if (next >= unigram_ids.size())
+            unigram_ids.resize(next + 1, npos);
+          if (unigram_ids[next] == npos)
+            unigram_ids[next] = intern(&next);
+          return unigram_ids[next];
+        }
+        const auto* ngram = get(id);
+        shift_buffer.assign(ngram + 1, ngram + order);
+        shift_buffer.emplace_back(next);
+        return intern(shift_buffer.data());
+      }
+      
+      // The order ids of n-gram id. Invalidated by intern().
+      const uint32_t* get(uint32_t id) const { return ngrams.data() + static_cast<size_t>(id) * order; }
+      // All n-grams back to back, in id order.
+      const std::vector<uint32_t>& get_ngrams() const { return ngrams; }
+      size_t size() const { return ngrams.size() / order; }
+      size_t get_order() const { return order; }
+    };
+    
+    // Sections of a MarkovChain snapshot file, in file order.
+    enum class SnapshotSection
+    {
+      Offsets,
+      TargetItems,
+      NextContexts,
+      Weights,
+      AliasProbs,
+      AliasSlots,
+      Counts,
+      FallbackStartContexts,
+      ContextNGrams,
+      ItemOffsets,
+      ItemData,
+      NUM_ITEMS
+    };
+    
+    struct SnapshotHeader
+    {
+      char magic[8];
+      uint32_t version = 0;
+      // Written as 0x01020304 to reject files from machines of the other byte order.
+      uint32_t byte_order_mark = 0;
+      uint32_t order = 0;
+      // sizeof(T) for trivially copyable items, 0 for std::string items.
+      uint32_t item_size = 0;
+      uint32_t empty_id = 0;
+      uint32_t start_context = 0;
+      uint64_t num_items = 0;
+      uint64_t num_contexts = 0;
+      uint64_t num_transitions = 0;
+      uint64_t num_fallback_start_contexts = 0;
+      // Byte offset from the start of the file and byte size of each section.
+      uint64_t section_offsets[static_cast<int>(SnapshotSection::NUM_ITEMS)] {};
+      uint64_t section_sizes[static_cast<int>(SnapshotSection::NUM_ITEMS)] {};
+    };
+    
+    constexpr char c_snapshot_magic[8] = { 'C', 'O', 'R', 'E', 'M', 'C', 'S', 'N' };
+    constexpr uint32_t c_snapshot_version = 1;
+    constexpr uint32_t c_snapshot_byte_order_mark = 0x01020304;
+    // Sections start at multiples of a cache line, so the arrays can be used in place when mapped.
+    constexpr uint64_t c_snapshot_alignment = 64;
+  
+  }
+
+  struct ImportStats
+  {
+    size_t num_bytes = 0;
+    size_t num_lines = 0;
+    size_t num_tokens = 0;
+    size_t num_chunks = 0;
+    int num_threads = 0;
+    double elapsed_s = 0.0;
+    double mb_per_s = 0.0;
+  };
+  
+  // How generate() picks the first item of a sequence.
+  enum class StartMode
+  {
+    // By how often each item started a sequence in add_transitions().
+    StartCounts,
+    // Uniformly among the contexts with transitions, as chains did before start counts were kept.
+    Uniform
+  };
+  
+  struct GenerateStats
+  {
+    size_t num_sequences = 0;
+    // Sequences drawn, including those rejected for their length.
+    size_t num_draws = 0;
+    size_t num_rejected = 0;
+    int num_threads = 0;
+    double elapsed_s = 0.0;
+    double rejection_rate = 0.0;
+    double sequences_per_s = 0.0;
+  };
+
+  // Items are interned to dense item ids as they are added, and the contexts of an order k chain
+  //   (the k most recent items, padded with empty_item at the start of a sequence) to dense context ids
+  //   in a detail::NGramTable. While training, transition counts live in an open addressing table keyed
+  //   on (context, next item) ids, so add_transitions() is O(1) per item regardless of the fan-out.
+  // normalize_transition_weights() then packs the transitions into a flat CSR layout
+  //   (per-context offsets into contiguous arrays) that also holds the context each transition leads to,
+  //   so generate() never has to look a context up.
+  // Each context also gets a Walker/Vose alias table, so generate() picks every next item in O(1).
+  //   Sequences start from the context of only empty_item, i.e. according to how often each item
+  //   started a sequence in add_transitions(). This is intentional and differs from earlier versions,
+  //   which started uniformly among the states with transitions; set_start_mode(StartMode::Uniform)
+  //   restores that. Without start counts, e.g. after only add_transition(), sequences start uniformly
+  //   among the contexts with transitions in either mode.
+  // A normalized chain can be saved with save_snapshot(). load_snapshot() maps such a file and generates
+  //   straight from its arrays, so only the items themselves are copied when loading.
   template<typename T>
   class MarkovChain
   {
   public:
     using MarkovChainTransitionTable = std::map<T, std::vector<std::pair<T, float>>>;
-    MarkovChainTransitionTable mctt;
-    T empty_item;
+    using NGramTransitionTable = std::map<std::vector<T>, std::vector<std::pair<T, float>>>;
+    using ItemId = uint32_t;
+    using ContextId = uint32_t;
     
-    MarkovChain(T empty_val) : empty_item(empty_val) {}
-  
-    void add_transition(T from, T to)
+  private:
+    int order = 1;
+    std::unordered_map<T, ItemId> item_ids;
+    std::vector<T> items;
+    ItemId empty_id = 0;
+    detail::NGramTable contexts;
+    ContextId start_context = 0;
+    // Transition counts keyed on context << 32 | next item.
+    detail::FlatCountTable transition_counts;
+    std::vector<ItemId> context_buffer;
+    
+    // CSR layout built by normalize_transition_weights().
+    //   The transitions of context c are in [offsets[c], offsets[c+1]) of the other arrays,
+    //   sorted by ascending weight and normalized to sum to one.
+    std::vector<uint32_t> offsets;
+    std::vector<ItemId> target_items;
+    // Context after target_items[t_idx], unless that is empty_item.
+    std::vector<ContextId> next_contexts;
+    std::vector<float> weights;
+    // Alias tables over the same ranges: slot t_idx is picked with probability alias_probs[t_idx]
+    //   and slot alias_slots[t_idx] otherwise.
+    std::vector<float> alias_probs;
+    std::vector<uint32_t> alias_slots;
+    // Contexts to start from uniformly when the start context has no transitions.
+    std::vector<ContextId> fallback_start_contexts;
+    // Transition counts in the same order, so that a loaded snapshot can be trained further.
+    std::vector<uint64_t> counts;
+    bool normalized = false;
+    StartMode start_mode = StartMode::StartCounts;
+    
+    // What generate() and the tables read once normalized: either the vectors above
+    //   or the sections of a snapshot mapped by load_snapshot().
+    struct ModelView
+    {
+      std::span<const uint32_t> offsets;
+      std::span<const ItemId> target_items;
+      std::span<const ContextId> next_contexts;
+      std::span<const float> weights;
+      std::span<const float> alias_probs;
+      std::span<const uint32_t> alias_slots;
+      std::span<const uint64_t> counts;
+      std::span<const ContextId> fallback_start_contexts;
+      std::span<const ItemId> context_ngrams;
+    };
+    // Shared, so that copies of a loaded chain keep the mapping alive.
+    std::shared_ptr<const mapped_file::MappedFile> snapshot;
+    ModelView snapshot_model;
+    
+    ModelView get_model() const
     {
-      auto& targets = mctt[from];
-      auto it = std::find_if(targets.begin(), targets.end(), [&to](const auto& ipair) { return ipair.first == to; });
-      if (it != targets.end())
-        it->second++;
+      if (snapshot != nullptr)
+        return snapshot_model;
+      return { offsets, target_items, next_contexts, weights, alias_probs, alias_slots, counts,
+               fallback_start_contexts, contexts.get_ngrams() };
+    }
+    
+    // Before training a chain loaded from a snapshot, rebuilds the training state from it
+    //   and drops the mapping.
+    void thaw_snapshot()
+    {
+      if (snapshot == nullptr)
+        return;
+      auto model = snapshot_model;
+      item_ids.clear();
+      for (ItemId id = 0; id < static_cast<ItemId>(items.size()); ++id)
+        item_ids.emplace(items[id], id);
+      contexts = detail::NGramTable(static_cast<size_t>(order));
+      for (size_t n_idx = 0; n_idx < model.context_ngrams.size(); n_idx += order)
+        contexts.intern(&model.context_ngrams[n_idx]);
+      transition_counts = detail::FlatCountTable {};
+      for (ContextId ctx = 0; ctx + 1 < static_cast<ContextId>(model.offsets.size()); ++ctx)
+        for (auto t_idx = model.offsets[ctx]; t_idx < model.offsets[ctx + 1]; ++t_idx)
+          transition_counts[transition_key(ctx, model.target_items[t_idx])] = model.counts[t_idx];
+      snapshot.reset();
+      snapshot_model = ModelView {};
+      normalized = false;
+    }
+    
+    ItemId intern(const T& item)
+    {
+      auto [it, inserted] = item_ids.try_emplace(item, static_cast<ItemId>(items.size()));
+      if (inserted)
+        items.emplace_back(item);
+      return it->second;
+    }
+    
+    static uint64_t transition_key(ContextId from, ItemId to)
+    {
+      return (static_cast<uint64_t>(from) << 32) | to;
+    }
+    
+    // Vose's alias method. Builds the alias table of the N weights in probs (need not be normalized),
+    //   overwriting probs with the acceptance probabilities. alias[i] gets the index of the alias of slot i.
+    static void build_alias_table(float* probs, uint32_t* alias, uint32_t N,
+                                  std::vector<uint32_t>& small, std::vector<uint32_t>& large)
+    {
+      double tot = 0.0;
+      for (uint32_t i = 0; i < N; ++i)
+        tot += probs[i];
+      small.clear();
+      large.clear();
+      for (uint32_t i = 0; i < N; ++i)
+      {
+        probs[i] = static_cast<float>(probs[i] * N / tot);
+        alias[i] = i;
+        (probs[i] < 1.f ? small : large).emplace_back(i);
+      }
+      while (!small.empty() && !large.empty())
+      {
+        auto s = small.back();
+        small.pop_back();
+        auto l = large.back();
+        alias[s] = l;
+        probs[l] -= 1.f - probs[s];
+        if (probs[l] < 1.f)
+        {
+          large.pop_back();
+          small.emplace_back(l);
+        }
+      }
+      // Whatever is left is only off from one by rounding.
+      for (auto i : large)
+        probs[i] = 1.f;
+      for (auto i : small)
+        probs[i] = 1.f;
+    }
+    
+    // Transitions of one chunk of an imported file, with tokens interned to chunk-local ids
+    //   that point into the mapped file. Local item id 0 is empty_item and local context id 0
+    //   is the start context.
+    struct PartialTable
+    {
+      std::unordered_map<std::string_view, ItemId> ids;
+      std::vector<std::string_view> items { std::string_view {} };
+      detail::NGramTable contexts;
+      detail::FlatCountTable counts;
+      size_t num_lines = 0;
+      size_t num_tokens = 0;
+      
+      PartialTable(size_t order) : contexts(order)
+      {
+        std::vector<ItemId> start(order, 0);
+        contexts.intern(start.data());
+      }
+    };
+    
+    static bool is_space(char c)
+    {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+    
+    // Same tokenization as the line-by-line istringstream >> extraction: each line is one sequence of
+    //   whitespace separated words.
+    static void tokenize_chunk(std::string_view chunk, PartialTable& partial)
+    {
+      size_t pos = 0;
+      while (pos < chunk.size())
+      {
+        auto eol = chunk.find('\n', pos);
+        if (eol == std::string_view::npos)
+          eol = chunk.size();
+        partial.num_lines++;
+        ContextId ctx = 0;
+        size_t p = pos;
+        while (true)
+        {
+          while (p < eol && is_space(chunk[p]))
+            p++;
+          if (p == eol)
+            break;
+          auto tok_start = p;
+          while (p < eol && !is_space(chunk[p]))
+            p++;
+          auto [it, inserted] = partial.ids.try_emplace(chunk.substr(tok_start, p - tok_start),
+                                                        static_cast<ItemId>(partial.items.size()));
+          if (inserted)
+            partial.items.emplace_back(it->first);
+          partial.counts[transition_key(ctx, it->second)]++;
+          ctx = partial.contexts.shift(ctx, it->second);
+          partial.num_tokens++;
+        }
+        if (ctx != 0)
+          partial.counts[transition_key(ctx, 0)]++;
+        pos = eol + 1;
+      }
+    }
+    
+    // Merging the chunks in file order interns new items and contexts in the order they first appear
+    //   in the file, so the ids, and thereby generate(), are the same as for a sequential import.
+    void merge_partial(const PartialTable& partial)
+    {
+      thaw_snapshot();
+      std::vector<ItemId> global_items(partial.items.size());
+      global_items[0] = empty_id;
+      for (size_t l_idx = 1; l_idx < partial.items.size(); ++l_idx)
+        global_items[l_idx] = intern(T(partial.items[l_idx]));
+      std::vector<ContextId> global_contexts(partial.contexts.size());
+      for (ContextId l_idx = 0; l_idx < static_cast<ContextId>(partial.contexts.size()); ++l_idx)
+      {
+        const auto* ngram = partial.contexts.get(l_idx);
+        context_buffer.clear();
+        for (int k = 0; k < order; ++k)
+          context_buffer.emplace_back(global_items[ngram[k]]);
+        global_contexts[l_idx] = contexts.intern(context_buffer.data());
+      }
+      partial.counts.for_each([&](uint64_t key, uint64_t count)
+      {
+        transition_counts[transition_key(global_contexts[key >> 32], global_items[key & 0xFFFF'FFFF])] += count;
+      });
+      normalized = false;
+    }
+    
+    // Calls f(ctx, item, weight) for every transition. See get_ngram_transition_table() for the weights.
+    template<typename Func>
+    void for_each_transition(Func f) const
+    {
+      if (normalized)
+      {
+        auto model = get_model();
+        for (ContextId ctx = 0; ctx + 1 < static_cast<ContextId>(model.offsets.size()); ++ctx)
+          for (auto t_idx = model.offsets[ctx]; t_idx < model.offsets[ctx + 1]; ++t_idx)
+            f(ctx, model.target_items[t_idx], model.weights[t_idx]);
+      }
       else
-        targets.emplace_back(to, 1);
+      {
+        transition_counts.for_each([&](uint64_t key, uint64_t count)
+        {
+          f(static_cast<ContextId>(key >> 32), static_cast<ItemId>(key & 0xFFFF'FFFF), static_cast<float>(count));
+        });
+      }
     }
     
-    void add_transitions(const std::vector<T>& items)
+    // Draws sequences until one has an accepted length, calling restart() before each draw
+    //   and emit(item) for each of its items. engine is a 64-bit rnd engine.
+    // Returns the number of sequences drawn.
+    template<typename Engine, typename Restart, typename Emit>
+    size_t walk(int min_num_items, int max_num_items, Engine& engine, Restart restart, Emit emit) const
     {
-      auto N = static_cast<int>(items.size());
-      if (N >= 2)
+      if (!normalized)
+        return 0;
+      auto model = get_model();
+      bool has_start = start_mode == StartMode::StartCounts
+        && model.offsets[start_context] < model.offsets[start_context + 1];
+      auto num_fallback = static_cast<uint32_t>(model.fallback_start_contexts.size());
+      if (!has_start && num_fallback == 0)
+        return 0;
+      
+      size_t num_draws = 0;
+      int num_items = 0;
+      do
       {
-        for (int i = 0; i < N - 1; ++i)
+        restart();
+        num_draws++;
+        num_items = 0;
+        auto ctx = start_context;
+        if (!has_start)
         {
-          T from = items[i];
-          T to = items[i+1];
-          add_transition(from, to);
+          ctx = model.fallback_start_contexts[detail::rand_index(engine, num_fallback)];
+          // The whole context, except for the empty_item padding of contexts near the start of a sequence.
+          for (int k = 0; k < order; ++k)
+          {
+            auto item = model.context_ngrams[static_cast<size_t>(ctx) * order + k];
+            if (item != empty_id)
+            {
+              emit(items[item]);
+              num_items++;
+            }
+          }
+        }
+        while (true)
+        {
+          auto begin = model.offsets[ctx];
+          auto end = model.offsets[ctx + 1];
+          if (begin == end)
+            break;
+          auto t_idx = begin + detail::rand_index(engine, end - begin);
+          if (detail::rand_unit(engine) >= model.alias_probs[t_idx])
+            t_idx = model.alias_slots[t_idx];
+          if (model.target_items[t_idx] == empty_id)
+            break;
+          emit(items[model.target_items[t_idx]]);
+          num_items++;
+          ctx = model.next_contexts[t_idx];
         }
+      } while ((min_num_items != -1 && num_items < min_num_items) || (max_num_items != -1 && num_items > max_num_items));
+      return num_draws;
+    }
+    
+    // generate() into ret, reusing its storage. Returns the number of sequences drawn.
+    template<typename Engine>
+    size_t generate_into(T& ret, int min_num_items, int max_num_items, Engine& engine) const
+    {
+      bool first = true;
+      ret = empty_item;
+      return walk(min_num_items, max_num_items, engine,
+                  [&]() { ret = empty_item; first = true; },
+                  [&](const T& item)
+                  {
+                    if (first)
+                      ret = item;
+                    else
+                      ret += item;
+                    first = false;
+                  });
+    }
+    
+  public:
+    T empty_item;
+    
+    // order is the number of preceding items that the next item depends on. It is clamped to at least 1.
+    MarkovChain(T empty_val, int num_context_items = 1)
+      : order(std::max(num_context_items, 1)), contexts(static_cast<size_t>(order)), empty_item(empty_val)
+    {
+      empty_id = intern(empty_item);
+      context_buffer.assign(order, empty_id);
+      start_context = contexts.intern(context_buffer.data());
+    }
+    
+    // Adds a transition from the context where from is the first item of a sequence,
+    //   which for order 1 chains is just from.
+    void add_transition(const T& from, const T& to)
+    {
+      thaw_snapshot();
+      context_buffer.assign(order, empty_id);
+      context_buffer.back() = intern(from);
+      auto ctx = contexts.intern(context_buffer.data());
+      transition_counts[transition_key(ctx, intern(to))]++;
+      normalized = false;
+    }
+    
+    // Adds the transitions of the sequence, from the start context through to empty_item after the last item.
+    void add_transitions(const std::vector<T>& sequence)
+    {
+      if (sequence.empty())
+        return;
+      thaw_snapshot();
+      auto ctx = start_context;
+      for (const auto& item : sequence)
+      {
+        auto item_id = intern(item);
+        transition_counts[transition_key(ctx, item_id)]++;
+        ctx = contexts.shift(ctx, item_id);
       }
-      if (N > 0)
-        add_transition(items[N-1], empty_item);
+      transition_counts[transition_key(ctx, empty_id)]++;
+      normalized = false;
     }
     
-    int import_transitions(const std::string& filename)
+    // Adds every line of whitespace separated words in the file as a sequence, as with add_transitions().
+    // The file is memory mapped and split into chunks at line breaks. The chunks are tokenized into
+    //   partial transition tables by num_threads worker threads (0 for one per hardware thread)
+    //   and then merged into this chain.
+    int import_transitions(const std::string& filename, int num_threads = 0, ImportStats* stats = nullptr)
     {
-      std::ifstream input(filename);
-      if (input.fail())
+      auto t0 = std::chrono::steady_clock::now();
+      mapped_file::MappedFile file;
+      if (!file.open(filename))
       {
         std::cerr << "Error opening file \"" + filename + "\"!" << std::endl;
         return EXIT_FAILURE;
       }
-      std::stringstream ss;
-      ss << input.rdbuf();
-      input.close();
+      auto text = file.view();
+      
+      if (num_threads <= 0)
+        num_threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+      // A few chunks per thread for load balancing, but none much smaller than a megabyte.
+      const size_t c_min_chunk_bytes = 1 << 20;
+      auto num_chunks = std::clamp<size_t>(text.size() / c_min_chunk_bytes, 1, static_cast<size_t>(num_threads) * 4);
+      std::vector<size_t> chunk_starts { 0 };
+      for (size_t c_idx = 1; c_idx < num_chunks; ++c_idx)
+      {
+        auto pos = std::max(text.size() * c_idx / num_chunks, chunk_starts.back());
+        pos = text.find('\n', pos);
+        if (pos == std::string_view::npos)
+          break;
+        chunk_starts.emplace_back(pos + 1);
+      }
+      chunk_starts.emplace_back(text.size());
+      num_chunks = chunk_starts.size() - 1;
+      num_threads = std::min(num_threads, static_cast<int>(num_chunks));
+      
+      std::vector<PartialTable> partials(num_chunks, PartialTable(static_cast<size_t>(order)));
+      std::atomic<size_t> next_chunk { 0 };
+      auto worker = [&]()
+      {
+        for (auto c_idx = next_chunk++; c_idx < num_chunks; c_idx = next_chunk++)
+          tokenize_chunk(text.substr(chunk_starts[c_idx], chunk_starts[c_idx + 1] - chunk_starts[c_idx]),
+                         partials[c_idx]);
+      };
+      if (num_threads == 1)
+        worker();
+      else
+      {
+        std::vector<std::thread> threads;
+        for (int t_idx = 0; t_idx < num_threads; ++t_idx)
+          threads.emplace_back(worker);
+        for (auto& th : threads)
+          th.join();
+      }
       
-      std::string line;
-      while (std::getline(ss, line))
+      size_t num_lines = 0;
+      size_t num_tokens = 0;
+      for (auto& partial : partials)
       {
-        // Break line into words.
-        std::istringstream iss(line);
-        std::vector<std::string> word_vec;
-        std::string word;
-        while (iss >> word)
-          word_vec.emplace_back(word);
-        
-        add_transitions(word_vec);
+        merge_partial(partial);
+        num_lines += partial.num_lines;
+        num_tokens += partial.num_tokens;
+        partial = PartialTable(static_cast<size_t>(order));
       }
       
+      auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      ImportStats import_stats;
+      import_stats.num_bytes = text.size();
+      import_stats.num_lines = num_lines;
+      import_stats.num_tokens = num_tokens;
+      import_stats.num_chunks = num_chunks;
+      import_stats.num_threads = num_threads;
+      import_stats.elapsed_s = elapsed_s;
+      import_stats.mb_per_s = elapsed_s > 0.0 ? static_cast<double>(text.size()) / 1e6 / elapsed_s : 0.0;
+      utils::try_set(stats, import_stats);
+      
       return EXIT_SUCCESS;
     }
     
+    int get_order() const { return order; }
+    // Number of distinct items, including empty_item.
+    size_t get_num_states() const { return items.size(); }
+    // Number of distinct contexts, including the start context.
+    size_t get_num_contexts() const
+    {
+      return snapshot != nullptr ? snapshot_model.context_ngrams.size() / order : contexts.size();
+    }
+    // Number of distinct (context, next item) pairs, including those from the start context.
+    size_t get_num_transitions() const
+    {
+      return snapshot != nullptr ? snapshot_model.target_items.size() : transition_counts.size();
+    }
+    bool is_normalized() const { return normalized; }
+    
+    // Takes effect immediately and is not stored in snapshots.
+    void set_start_mode(StartMode mode) { start_mode = mode; }
+    StartMode get_start_mode() const { return start_mode; }
+    
+    // The transitions as a map from each context (its order items) to the next items.
+    //   Weights are normalized after normalize_transition_weights() and raw counts before it.
+    NGramTransitionTable get_ngram_transition_table() const
+    {
+      NGramTransitionTable table;
+      auto context_ngrams = get_model().context_ngrams;
+      for_each_transition([&](ContextId ctx, ItemId item, float w)
+      {
+        std::vector<T> key;
+        for (int k = 0; k < order; ++k)
+          key.emplace_back(items[context_ngrams[static_cast<size_t>(ctx) * order + k]]);
+        table[key].emplace_back(items[item], w);
+      });
+      return table;
+    }
+    
+    // For order 1 chains, the transitions as a map from each item to the next items,
+    //   without those from the start context. Empty for higher orders.
+    MarkovChainTransitionTable get_transition_table() const
+    {
+      MarkovChainTransitionTable mctt;
+      if (order != 1)
+        return mctt;
+      auto context_ngrams = get_model().context_ngrams;
+      for_each_transition([&](ContextId ctx, ItemId item, float w)
+      {
+        if (ctx != start_context)
+          mctt[items[context_ngrams[ctx]]].emplace_back(items[item], w);
+      });
+      return mctt;
+    }
+    
     void print() const
     {
-      for (const auto& state : mctt)
+      for (const auto& [ctx, trgs] : get_ngram_transition_table())
       {
-        std::cout << " [" << state.first << "] :" << std::endl;
-        for (const auto& trg : state.second)
+        if (std::all_of(ctx.begin(), ctx.end(), [this](const T& item) { return item == empty_item; }))
+          continue;
+        std::cout << " [";
+        for (size_t k = 0; k < ctx.size(); ++k)
+          std::cout << (k > 0 ? " " : "") << ctx[k];
+        std::cout << "] :" << std::endl;
+        for (const auto& trg : trgs)
           std::cout << "   => " << trg.first << " : " << trg.second << std::endl;
       }
     }
   
+    // Builds the CSR layout and alias tables used by generate().
+    //   Must be called again after adding more transitions.
     void normalize_transition_weights()
     {
-      for (auto& targets : mctt)
+      if (snapshot != nullptr)
+        return;
+      auto num_contexts = contexts.size();
+      offsets.assign(num_contexts + 1, 0);
+      transition_counts.for_each([&](uint64_t key, uint64_t) { offsets[(key >> 32) + 1]++; });
+      for (size_t ctx = 0; ctx < num_contexts; ++ctx)
+        offsets[ctx + 1] += offsets[ctx];
+      
+      auto num_transitions = transition_counts.size();
+      target_items.resize(num_transitions);
+      counts.resize(num_transitions);
+      std::vector<uint32_t> fill_pos(offsets.begin(), offsets.end() - 1);
+      transition_counts.for_each([&](uint64_t key, uint64_t count)
       {
-        int tot = 0;
-        for (const auto& trg : targets.second)
-          tot += trg.second;
-        if (tot > 0)
+        auto t_idx = fill_pos[key >> 32]++;
+        target_items[t_idx] = static_cast<ItemId>(key & 0xFFFF'FFFF);
+        counts[t_idx] = count;
+      });
+      
+      fallback_start_contexts.clear();
+      next_contexts.resize(num_transitions);
+      weights.resize(num_transitions);
+      alias_probs.resize(num_transitions);
+      alias_slots.resize(num_transitions);
+      std::vector<std::pair<uint64_t, ItemId>> row;
+      std::vector<uint32_t> small, large;
+      for (ContextId ctx = 0; ctx < static_cast<ContextId>(num_contexts); ++ctx)
+      {
+        auto begin = offsets[ctx];
+        auto end = offsets[ctx + 1];
+        if (begin == end)
+          continue;
+        if (ctx != start_context)
+          fallback_start_contexts.emplace_back(ctx);
+        row.clear();
+        double tot = 0.0;
+        for (auto t_idx = begin; t_idx < end; ++t_idx)
+        {
+          row.emplace_back(counts[t_idx], target_items[t_idx]);
+          tot += static_cast<double>(counts[t_idx]);
+        }
+        // Ties are broken on the item id so that the layout does not depend on the hash table order.
+        std::sort(row.begin(), row.end());
+        for (size_t r_idx = 0; r_idx < row.size(); ++r_idx)
         {
-          for (auto& trg : targets.second)
-            trg.second /= tot;
+          auto t_idx = begin + static_cast<uint32_t>(r_idx);
+          weights[t_idx] = static_cast<float>(static_cast<double>(row[r_idx].first) / tot);
+          target_items[t_idx] = row[r_idx].second;
+          counts[t_idx] = row[r_idx].first;
+          alias_probs[t_idx] = static_cast<float>(row[r_idx].first);
+          // Contexts that only ever end in add_transition() targets are added here, without transitions.
+          next_contexts[t_idx] = row[r_idx].second == empty_id ? start_context :
+            contexts.shift(ctx, row[r_idx].second);
         }
-        std::sort(targets.second.begin(), targets.second.end(),
-                  [](const auto& A, const auto& B) { return A.second < B.second; });
+        build_alias_table(&alias_probs[begin], &alias_slots[begin], end - begin, small, large);
+        for (auto t_idx = begin; t_idx < end; ++t_idx)
+          alias_slots[t_idx] += begin;
       }
+      offsets.resize(contexts.size() + 1, offsets.back());
+      normalized = true;
+    }
+    
+    // The items of a random sequence, not including the final empty_item.
+    // Sequences are redrawn until their length is within [min_num_items, max_num_items] (-1 for no limit).
+    // Returns an empty sequence until normalize_transition_weights() has been called.
+    std::vector<T> generate_sequence(int min_num_items = -1, int max_num_items = -1) const
+    {
+      std::vector<T> sequence;
+      walk(min_num_items, max_num_items, rnd::default_engine(),
+           [&sequence]() { sequence.clear(); },
+           [&sequence](const T& item) { sequence.emplace_back(item); });
+      return sequence;
     }
     
+    // The items of generate_sequence() concatenated with operator+=, e.g. a word from syllables
+    //   for T = std::string. Returns empty_item for an empty sequence.
     T generate(int min_num_items = -1, int max_num_items = -1) const
     {
-      auto N = mctt.size();
-      if (N == 0)
-        return empty_item;
-      
-      size_t num_items = 1;
       T ret = empty_item;
-      do
+      generate_into(ret, min_num_items, max_num_items, rnd::default_engine());
+      return ret;
+    }
+    
+    // Fills out with num_sequences results of generate(), using num_threads worker threads
+    //   (0 for one per hardware thread). The elements already in out are assigned to, so calling this
+    //   repeatedly with the same vector reuses their storage, e.g. the string capacities.
+    // The sequences are generated in blocks that each have their own rnd::Xoshiro256ss stream:
+    //   block b uses an engine seeded with seed and jump()ed b + 1 times, so the streams are disjoint
+    //   and the result only depends on seed and not on num_threads.
+    // Without a seed, one is drawn from rnd::default_engine(), so that like generate() every call gives
+    //   a new batch and rnd::srand() makes the calls reproducible. Otherwise rnd::default_engine() is left untouched.
+    void generate_batch(std::vector<T>& out, size_t num_sequences, int num_threads = 0,
+                        int min_num_items = -1, int max_num_items = -1, std::optional<uint64_t> seed = std::nullopt,
+                        GenerateStats* stats = nullptr) const
+    {
+      auto t0 = std::chrono::steady_clock::now();
+      auto batch_seed = seed.has_value() ? seed.value() : rnd::default_engine()();
+      out.resize(num_sequences, empty_item);
+      
+      const size_t c_block_size = 4'096;
+      auto num_blocks = (num_sequences + c_block_size - 1) / c_block_size;
+      if (num_threads <= 0)
+        num_threads = static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u));
+      num_threads = static_cast<int>(std::clamp<size_t>(num_blocks, 1, static_cast<size_t>(num_threads)));
+      std::vector<rnd::Xoshiro256ss> block_engines;
+      block_engines.reserve(num_blocks);
+      rnd::Xoshiro256ss engine(batch_seed);
+      for (size_t b_idx = 0; b_idx < num_blocks; ++b_idx)
+      {
+        engine.jump();
+        block_engines.emplace_back(engine);
+      }
+      
+      std::atomic<size_t> next_block { 0 };
+      std::atomic<size_t> num_draws { 0 };
+      auto worker = [&]()
       {
-        num_items = 1;
-        auto rnd_idx = rnd::rand_int(0, static_cast<int>(N) - 1);
-        int ctr = 0;
-        const T* start_item_ptr = nullptr;
-        for (auto& item : mctt)
+        size_t thread_draws = 0;
+        for (auto b_idx = next_block++; b_idx < num_blocks; b_idx = next_block++)
         {
-          if (rnd_idx == ctr++)
-          {
-            start_item_ptr = &item.first;
-            break;
-          }
+          // A copy, so that threads do not share cache lines of the neighbouring engines.
+          auto block_engine = block_engines[b_idx];
+          auto end = std::min((b_idx + 1) * c_block_size, num_sequences);
+          for (auto s_idx = b_idx * c_block_size; s_idx < end; ++s_idx)
+            thread_draws += generate_into(out[s_idx], min_num_items, max_num_items, block_engine);
         }
-        if (start_item_ptr == nullptr)
-          return empty_item;
-        
-        T item = *start_item_ptr;
-        
-        ret = item;
-        while (item != "")
+        num_draws += thread_draws;
+      };
+      if (num_threads == 1)
+        worker();
+      else
+      {
+        std::vector<std::thread> threads;
+        for (int t_idx = 0; t_idx < num_threads; ++t_idx)
+          threads.emplace_back(worker);
+        for (auto& th : threads)
+          th.join();
+      }
+      
+      auto elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      GenerateStats generate_stats;
+      generate_stats.num_sequences = num_sequences;
+      generate_stats.num_draws = num_draws;
+      generate_stats.num_rejected = num_draws > num_sequences ? num_draws - num_sequences : 0;
+      generate_stats.num_threads = num_threads;
+      generate_stats.elapsed_s = elapsed_s;
+      generate_stats.rejection_rate = num_draws > 0 ? static_cast<double>(generate_stats.num_rejected) / num_draws : 0.0;
+      generate_stats.sequences_per_s = elapsed_s > 0.0 ? static_cast<double>(num_sequences) / elapsed_s : 0.0;
+      utils::try_set(stats, generate_stats);
+    }
+    
+    std::vector<T> generate_batch(size_t num_sequences, int num_threads = 0,
+                                  int min_num_items = -1, int max_num_items = -1, std::optional<uint64_t> seed = std::nullopt,
+                                  GenerateStats* stats = nullptr) const
+    {
+      std::vector<T> out;
+      generate_batch(out, num_sequences, num_threads, min_num_items, max_num_items, seed, stats);
+      return out;
+    }
+    
+    // Writes the normalized chain to a binary file for load_snapshot().
+    // The file is in native byte order. T must be std::string or trivially copyable.
+    int save_snapshot(const std::string& filename) const
+    {
+      if (!normalized)
+      {
+        std::cerr << "Error: Normalize the transition weights before saving \"" + filename + "\"!" << std::endl;
+        return EXIT_FAILURE;
+      }
+      auto model = get_model();
+      
+      std::vector<uint64_t> item_offsets;
+      std::vector<char> item_data;
+      if constexpr (std::is_same_v<T, std::string>)
+      {
+        item_offsets.emplace_back(0);
+        for (const auto& item : items)
         {
-          auto t = rnd::rand();
-          const auto& entry = mctt.at(item);
-          for (const auto& trg : entry)
-          {
-            if (t < trg.second)
-            {
-              item = trg.first;
-              ret += item;
-              if (item != "")
-                num_items++;
-              break;
-            }
-            t -= trg.second;
-          }
+          item_data.insert(item_data.end(), item.begin(), item.end());
+          item_offsets.emplace_back(item_data.size());
         }
-      } while ((min_num_items != -1 && num_items < min_num_items) || (max_num_items != -1 && num_items > max_num_items));
-
+      }
+      else
+      {
+        static_assert(std::is_trivially_copyable_v<T>, "Snapshots need std::string or trivially copyable items.");
+        item_data.resize(items.size() * sizeof(T));
+        if (!items.empty())
+          std::memcpy(item_data.data(), items.data(), item_data.size());
+      }
       
-      return ret;
+      detail::SnapshotHeader header;
+      std::memcpy(header.magic, detail::c_snapshot_magic, sizeof(header.magic));
+      header.version = detail::c_snapshot_version;
+      header.byte_order_mark = detail::c_snapshot_byte_order_mark;
+      header.order = static_cast<uint32_t>(order);
+      header.item_size = std::is_same_v<T, std::string> ? 0 : static_cast<uint32_t>(sizeof(T));
+      header.empty_id = empty_id;
+      header.start_context = start_context;
+      header.num_items = items.size();
+      header.num_contexts = model.offsets.size() - 1;
+      header.num_transitions = model.target_items.size();
+      header.num_fallback_start_contexts = model.fallback_start_contexts.size();
+      
+      using detail::SnapshotSection;
+      std::vector<std::pair<const void*, size_t>> sections(static_cast<size_t>(SnapshotSection::NUM_ITEMS));
+      auto set_section = [&sections](SnapshotSection sec, auto span)
+      {
+        sections[static_cast<size_t>(sec)] = { span.data(), span.size_bytes() };
+      };
+      set_section(SnapshotSection::Offsets, model.offsets);
+      set_section(SnapshotSection::TargetItems, model.target_items);
+      set_section(SnapshotSection::NextContexts, model.next_contexts);
+      set_section(SnapshotSection::Weights, model.weights);
+      set_section(SnapshotSection::AliasProbs, model.alias_probs);
+      set_section(SnapshotSection::AliasSlots, model.alias_slots);
+      set_section(SnapshotSection::Counts, model.counts);
+      set_section(SnapshotSection::FallbackStartContexts, model.fallback_start_contexts);
+      set_section(SnapshotSection::ContextNGrams, model.context_ngrams);
+      set_section(SnapshotSection::ItemOffsets, std::span<const uint64_t>(item_offsets));
+      set_section(SnapshotSection::ItemData, std::span<const char>(item_data));
+      
+      auto align_up = [](uint64_t pos) { return (pos + detail::c_snapshot_alignment - 1) / detail::c_snapshot_alignment * detail::c_snapshot_alignment; };
+      uint64_t pos = align_up(sizeof(header));
+      for (size_t s_idx = 0; s_idx < sections.size(); ++s_idx)
+      {
+        header.section_offsets[s_idx] = pos;
+        header.section_sizes[s_idx] = sections[s_idx].second;
+        pos = align_up(pos + sections[s_idx].second);
+      }
+      
+      std::ofstream out(filename, std::ios::binary);
+      if (!out.is_open())
+      {
+        std::cerr << "Error opening file \"" + filename + "\" for writing!" << std::endl;
+        return EXIT_FAILURE;
+      }
+      const std::vector<char> padding(detail::c_snapshot_alignment, 0);
+      uint64_t written = sizeof(header);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (size_t s_idx = 0; s_idx < sections.size(); ++s_idx)
+      {
+        out.write(padding.data(), static_cast<std::streamsize>(header.section_offsets[s_idx] - written));
+        out.write(static_cast<const char*>(sections[s_idx].first), static_cast<std::streamsize>(sections[s_idx].second));
+        written = header.section_offsets[s_idx] + sections[s_idx].second;
+      }
+      if (!out)
+      {
+        std::cerr << "Error writing file \"" + filename + "\"!" << std::endl;
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    }
+    
+    // Replaces this chain, including its order and empty_item, by a snapshot from save_snapshot().
+    // The file stays mapped and generate() reads the transitions from it in place. Only the items are
+    //   copied, and the training state is only rebuilt if more transitions are added.
+    // Every section size and every item, context and transition index is checked before the mapping
+    //   is accepted, so a truncated or corrupt file fails to load rather than being read out of bounds.
+    int load_snapshot(const std::string& filename)
+    {
+      auto file = std::make_shared<mapped_file::MappedFile>();
+      if (!file->open(filename))
+      {
+        std::cerr << "Error opening file \"" + filename + "\"!" << std::endl;
+        return EXIT_FAILURE;
+      }
+      auto fail = [&filename](const std::string& reason)
+      {
+        std::cerr << "Error loading snapshot \"" + filename + "\": " + reason + "!" << std::endl;
+        return EXIT_FAILURE;
+      };
+      
+      detail::SnapshotHeader header;
+      if (file->size() < sizeof(header))
+        return fail("file too small");
+      std::memcpy(&header, file->data(), sizeof(header));
+      if (std::memcmp(header.magic, detail::c_snapshot_magic, sizeof(header.magic)) != 0)
+        return fail("not a MarkovChain snapshot");
+      if (header.version != detail::c_snapshot_version)
+        return fail("unsupported version " + std::to_string(header.version));
+      if (header.byte_order_mark != detail::c_snapshot_byte_order_mark)
+        return fail("wrong byte order");
+      if (header.item_size != (std::is_same_v<T, std::string> ? 0 : sizeof(T)))
+        return fail("item type mismatch");
+      if (header.order == 0 || header.num_contexts == 0
+          || header.empty_id >= header.num_items || header.start_context >= header.num_contexts
+          || header.order > file->size() || header.num_contexts > file->size())
+        return fail("corrupt header");
+      
+      bool sections_ok = true;
+      auto get_section = [&]<typename U>(detail::SnapshotSection sec, uint64_t count, const U*)
+      {
+        auto s_idx = static_cast<size_t>(sec);
+        auto offset = header.section_offsets[s_idx];
+        auto num_bytes = header.section_sizes[s_idx];
+        if (count > file->size() / sizeof(U) || num_bytes != count * sizeof(U) || offset % alignof(U) != 0
+            || offset > file->size() || num_bytes > file->size() - offset)
+        {
+          sections_ok = false;
+          return std::span<const U> {};
+        }
+        return std::span<const U>(reinterpret_cast<const U*>(file->data() + offset), static_cast<size_t>(count));
+      };
+      using detail::SnapshotSection;
+      ModelView model;
+      model.offsets = get_section(SnapshotSection::Offsets, header.num_contexts + 1, static_cast<const uint32_t*>(nullptr));
+      model.target_items = get_section(SnapshotSection::TargetItems, header.num_transitions, static_cast<const ItemId*>(nullptr));
+      model.next_contexts = get_section(SnapshotSection::NextContexts, header.num_transitions, static_cast<const ContextId*>(nullptr));
+      model.weights = get_section(SnapshotSection::Weights, header.num_transitions, static_cast<const float*>(nullptr));
+      model.alias_probs = get_section(SnapshotSection::AliasProbs, header.num_transitions, static_cast<const float*>(nullptr));
+      model.alias_slots = get_section(SnapshotSection::AliasSlots, header.num_transitions, static_cast<const uint32_t*>(nullptr));
+      model.counts = get_section(SnapshotSection::Counts, header.num_transitions, static_cast<const uint64_t*>(nullptr));
+      model.fallback_start_contexts = get_section(SnapshotSection::FallbackStartContexts, header.num_fallback_start_contexts,
+                                                  static_cast<const ContextId*>(nullptr));
+      model.context_ngrams = get_section(SnapshotSection::ContextNGrams, header.num_contexts * header.order,
+                                         static_cast<const ItemId*>(nullptr));
+      if (!sections_ok)
+        return fail("corrupt sections");
+      if (model.offsets.front() != 0 || model.offsets.back() != header.num_transitions
+          || !std::is_sorted(model.offsets.begin(), model.offsets.end()))
+        return fail("corrupt transition offsets");
+      auto num_contexts = header.num_contexts;
+      auto num_items = header.num_items;
+      for (uint64_t ctx = 0; ctx < num_contexts; ++ctx)
+        for (auto t_idx = model.offsets[ctx]; t_idx < model.offsets[ctx + 1]; ++t_idx)
+          if (model.target_items[t_idx] >= num_items || model.next_contexts[t_idx] >= num_contexts
+              || model.alias_slots[t_idx] < model.offsets[ctx] || model.alias_slots[t_idx] >= model.offsets[ctx + 1])
+            return fail("corrupt transitions");
+      for (auto ctx : model.fallback_start_contexts)
+        if (ctx >= num_contexts)
+          return fail("corrupt start contexts");
+      for (auto item : model.context_ngrams)
+        if (item >= num_items)
+          return fail("corrupt contexts");
+      
+      std::vector<T> loaded_items;
+      if constexpr (std::is_same_v<T, std::string>)
+      {
+        auto item_offsets = get_section(SnapshotSection::ItemOffsets, header.num_items + 1, static_cast<const uint64_t*>(nullptr));
+        if (!sections_ok)
+          return fail("corrupt items");
+        auto item_data = get_section(SnapshotSection::ItemData, item_offsets.back(), static_cast<const char*>(nullptr));
+        if (!sections_ok || !std::is_sorted(item_offsets.begin(), item_offsets.end()))
+          return fail("corrupt items");
+        loaded_items.reserve(header.num_items);
+        for (size_t i_idx = 0; i_idx < header.num_items; ++i_idx)
+          loaded_items.emplace_back(item_data.data() + item_offsets[i_idx], item_offsets[i_idx + 1] - item_offsets[i_idx]);
+      }
+      else
+      {
+        static_assert(std::is_trivially_copyable_v<T>, "Snapshots need std::string or trivially copyable items.");
+        auto item_data = get_section(SnapshotSection::ItemData, header.num_items * sizeof(T), static_cast<const char*>(nullptr));
+        if (!sections_ok)
+          return fail("corrupt items");
+        loaded_items.resize(header.num_items);
+        if (!loaded_items.empty())
+          std::memcpy(static_cast<void*>(loaded_items.data()), item_data.data(), item_data.size());
+      }
+      
+      order = static_cast<int>(header.order);
+      items = std::move(loaded_items);
+      item_ids.clear();
+      empty_id = header.empty_id;
+      empty_item = items[empty_id];
+      start_context = header.start_context;
+      contexts = detail::NGramTable(static_cast<size_t>(order));
+      transition_counts = detail::FlatCountTable {};
+      for (auto* vec : { &offsets, &target_items, &next_contexts, &alias_slots, &fallback_start_contexts })
+        vec->clear();
+      weights.clear();
+      alias_probs.clear();
+      counts.clear();
+      snapshot = std::move(file);
+      snapshot_model = model;
+      normalized = true;
+      return EXIT_SUCCESS;
     }
   };
 
@@ -0,0 +1,117 @@
+//
+//  PerThreadShards.h
+//  Core Lib
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace utils
+{
+
+  namespace detail
+  {
+
+    // One Shard per thread that touches the owning instance, for lock-free per-thread recording.
+    // local() only takes the mutex the first time a thread asks for its shard. Each thread caches
+    //   its shards per instance and gets the same shard back for as long as the instance lives.
+    // The shards are owned here and live until the instance is destroyed, so for_each() sees the
+    //   contributions of threads that have since exited.
+    template<typename Shard>
+    class PerThreadShards
+    {
+      static inline std::atomic<uint64_t> instance_ctr { 0 };
+      
+      // Never reused, so a cache entry can only be found again by its own instance.
+      const uint64_t instance_id = ++instance_ctr;
+      mutable std::mutex shards_mutex;
+      std::vector<std::unique_ptr<Shard>> shards;
+      // Expires with this instance, so that threads can drop their cache entries for it.
+      std::shared_ptr<const bool> alive_token = std::make_shared<const bool>(true);
+    
+    public:
+      PerThreadShards() = default;
+      PerThreadShards(const PerThreadShards&) = delete;
+      PerThreadShards& operator=(const PerThreadShards&) = delete;
+      
+      // The calling thread's shard, created with make_shard() (returning a std::unique_ptr<Shard>)
+      //   the first time this thread asks for it.
+      template<typename MakeShard>
+      Shard& local(MakeShard make_shard)
+      {
+        struct CacheEntry
+        {
+          Shard* shard = nullptr;
+          std::weak_ptr<const bool> alive;
+        };
+        // The most recently used instance, then every instance this thread has touched.
+        //   Dead entries are pruned when the map has doubled in size since the last pruning,
+        //   so live entries are never dropped and the map stays within twice the live ones.
+        struct ThreadCache
+        {
+          uint64_t last_instance_id = 0;
+          Shard* last_shard = nullptr;
+          std::unordered_map<uint64_t, CacheEntry> entries;
+          size_t prune_size = 16;
+        };
+        thread_local ThreadCache cache;
+        if (cache.last_instance_id == instance_id)
+          return *cache.last_shard;
+        Shard* shard = nullptr;
+        auto it = cache.entries.find(instance_id);
+        if (it != cache.entries.end())
+          shard = it->second.shard;
+        else
+        {
+          auto new_shard = make_shard();
+          {
+            std::lock_guard<std::mutex> lock(shards_mutex);
+            shard = shards.emplace_back(std::move(new_shard)).get();
+          }
+          if (cache.entries.size() >= cache.prune_size)
+          {
+            std::erase_if(cache.entries, [](const auto& entry) { return entry.second.alive.expired(); });
+            cache.prune_size = std::max<size_t>(16, 2 * cache.entries.size());
+          }
+          cache.entries.emplace(instance_id, CacheEntry { shard, alive_token });
+        }
+        cache.last_instance_id = instance_id;
+        cache.last_shard = shard;
+        return *shard;
+      }
+      
+      Shard& local()
+      {
+        return local([]() { return std::make_unique<Shard>(); });
+      }
+      
+      // Calls func(shard) for every shard, with the shards locked against new threads.
+      //   Threads may still be writing to their shards.
+      template<typename Func>
+      void for_each(Func func) const
+      {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        for (const auto& shard : shards)
+          func(*shard);
+      }
+      
+      // Number of threads that have asked for a shard.
+      size_t size() const
+      {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        return shards.size();
+      }
+    };
+
+  }
+
+}
@@ -0,0 +1,215 @@
+//
+//  QuantileSketch.h
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Histogram.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+
+namespace hist
+{
+
+  // KLL quantile sketch (Karnin, Lang, Liberty) for streams of unknown range and length.
+  // Samples are kept in a stack of compactors where an item on level h stands for 2^h samples.
+  //   When the sketch is full, the lowest full level is sorted and every other item (random offset)
+  //   is promoted to the level above, halving its size. Level capacities shrink geometrically
+  //   from the top by 2/3, so memory stays around 3*k items however many samples are added.
+  // The rank error of get_quantile() is roughly 1.7 / k, i.e. about 1 % for the default k = 200.
+  // Sketches are mergeable, e.g. one per thread, merged into one when reporting.
+  template<typename T>
+  class KllSketch
+  {
+    int k = 200;
+    std::vector<std::vector<T>> levels;
+    std::vector<size_t> level_capacities;
+    size_t capacity = 0;
+    size_t num_retained = 0;
+    size_t num_samples = 0;
+    T min_value = static_cast<T>(0);
+    T max_value = static_cast<T>(0);
+    std::minstd_rand rng;
+    
+    // Level capacities depend on the number of levels, so they are recomputed whenever a level is added.
+    void update_capacities()
+    {
+      level_capacities.resize(levels.size());
+      capacity = 0;
+      for (size_t h = 0; h < levels.size(); ++h)
+      {
+        auto depth = static_cast<double>(levels.size() - 1 - h);
+        level_capacities[h] = std::max(static_cast<size_t>(std::ceil(k * std::pow(2.0/3.0, depth))), 2_sz);
+        capacity += level_capacities[h];
+      }
+    }
+    
+    void compact_level(size_t h)
+    {
+      if (h + 1 == levels.size())
+      {
+        levels.emplace_back();
+        update_capacities();
+      }
+      auto& level = levels[h];
+      std::sort(level.begin(), level.end());
+      // With an odd number of items, the largest one stays behind on this level.
+      std::optional<T> leftover;
+      if (level.size() % 2 == 1)
+      {
+        leftover = level.back();
+        level.pop_back();
+      }
+      auto offset = static_cast<size_t>(rng() & 1);
+      auto& above = levels[h + 1];
+      for (size_t i = offset; i < level.size(); i += 2)
+        above.emplace_back(level[i]);
+      num_retained -= level.size() / 2;
+      level.clear();
+      if (leftover.has_value())
+        level.emplace_back(leftover.value());
+    }
+    
+    void compress()
+    {
+      while (num_retained >= capacity)
+      {
+        for (size_t h = 0; h < levels.size(); ++h)
+          if (levels[h].size() >= level_capacities[h])
+          {
+            compact_level(h);
+            break;
+          }
+      }
+    }
+    
+    // All retained items with their weights, sorted by value.
+    std::vector<std::pair<T, size_t>> weighted_items() const
+    {
+      std::vector<std::pair<T, size_t>> items;
+      items.reserve(num_retained);
+      for (size_t h = 0; h < levels.size(); ++h)
+        for (const auto& v : levels[h])
+          items.emplace_back(v, 1_sz << h);
+      std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+      return items;
+    }
+
+  public:
+    // k trades accuracy for memory. It is clamped to at least 8.
+    KllSketch(int k_param = 200, unsigned int seed = 1)
+      : k(std::max(k_param, 8)), levels(1), rng(seed)
+    {
+      update_capacities();
+    }
+    
+    void operator+=(T val)
+    {
+      if (num_samples == 0)
+        min_value = max_value = val;
+      else
+      {
+        math::minimize(min_value, val);
+        math::maximize(max_value, val);
+      }
+      num_samples++;
+      levels[0].emplace_back(val);
+      num_retained++;
+      if (num_retained >= capacity)
+        compress();
+    }
+    
+    // Adds the samples of other, as if they had been added to this sketch.
+    void merge(const KllSketch& other)
+    {
+      if (other.num_samples == 0)
+        return;
+      if (num_samples == 0)
+      {
+        min_value = other.min_value;
+        max_value = other.max_value;
+      }
+      else
+      {
+        math::minimize(min_value, other.min_value);
+        math::maximize(max_value, other.max_value);
+      }
+      num_samples += other.num_samples;
+      if (levels.size() < other.levels.size())
+      {
+        levels.resize(other.levels.size());
+        update_capacities();
+      }
+      for (size_t h = 0; h < other.levels.size(); ++h)
+        levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+      num_retained += other.num_retained;
+      compress();
+    }
+    
+    // q in [0, 1]. Returns the retained item whose weighted rank first reaches q, or 0 if empty.
+    T get_quantile(double q) const
+    {
+      if (num_samples == 0)
+        return static_cast<T>(0);
+      if (q <= 0.0)
+        return min_value;
+      if (q >= 1.0)
+        return max_value;
+      auto items = weighted_items();
+      auto target = q * static_cast<double>(num_samples);
+      size_t cum = 0;
+      for (const auto& [v, w] : items)
+      {
+        cum += w;
+        if (static_cast<double>(cum) >= target)
+          return v;
+      }
+      return max_value;
+    }
+    
+    // Estimated fraction of samples <= val.
+    double get_rank(T val) const
+    {
+      if (num_samples == 0)
+        return 0.0;
+      size_t cum = 0;
+      for (size_t h = 0; h < levels.size(); ++h)
+        for (const auto& v : levels[h])
+          if (v <= val)
+            cum += 1_sz << h;
+      return static_cast<double>(cum) / static_cast<double>(num_samples);
+    }
+    
+    T get_min() const { return min_value; }
+    T get_max() const { return max_value; }
+    size_t get_num_samples() const { return num_samples; }
+    size_t get_num_levels() const { return levels.size(); }
+    size_t get_num_retained() const { return num_retained; }
+    
+    // Count-only histogram over [min, max] of the weighted retained items.
+    Histogram<T> to_histogram(size_t N_buck) const
+    {
+      Histogram<T> hist(N_buck, min_value, max_value);
+      std::vector<size_t> counts(hist.get_num_buckets(), 0);
+      for (size_t h = 0; h < levels.size(); ++h)
+        for (const auto& v : levels[h])
+        {
+          auto b_idx = std::clamp(hist.bucket_index(v), 0l, static_cast<long>(counts.size()) - 1);
+          counts[b_idx] += 1_sz << h;
+        }
+      hist.add_counts(counts);
+      return hist;
+    }
+    
+    // Same bar chart as Histogram::to_stringbox(), over the range seen so far.
+    str::StringBox to_stringbox(int nr, int nc) const
+    {
+      return to_histogram(static_cast<size_t>(std::max(nc, 1))).to_stringbox(nr, nc);
+    }
+  };
+
+}
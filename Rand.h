@@ -11,11 +11,335 @@
 #include <ctime>
 #include <cassert>
 #include <limits>
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
+#include <span>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 
 namespace rnd
 {
 
+  // The engines below all produce 64-bit words and satisfy UniformRandomBitGenerator,
+  //   so they can also be used with the <random> distributions.
+  
+  // SplitMix64 by Sebastiano Vigna. Fast but with a small state, mostly used to expand
+  //   a single seed into the states of the other engines.
+  class SplitMix64
+  {
+    uint64_t state = 0;
+    
+  public:
+    using result_type = uint64_t;
+    
+    explicit SplitMix64(uint64_t seed = 0) : state(seed) {}
+    
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    
+    result_type operator()()
+    {
+      auto z = (state += 0x9E37'79B9'7F4A'7C15ull);
+      z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EBull;
+      return z ^ (z >> 31);
+    }
+  };
+  
+  // xoshiro256** by David Blackman and Sebastiano Vigna. 256 bits of state and a period of 2^256 - 1.
+  // This is the default engine.
+  class Xoshiro256ss
+  {
+    friend class Xoshiro256ssX4;
+    uint64_t s[4] {};
+    
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    
+  public:
+    using result_type = uint64_t;
+    
+    explicit Xoshiro256ss(uint64_t seed = 0) { this->seed(seed); }
+    
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    
+    // The state is expanded from seed with SplitMix64, so it is never all zeros.
+    void seed(uint64_t seed)
+    {
+      SplitMix64 sm(seed);
+      for (auto& w : s)
+        w = sm();
+    }
+    
+    result_type operator()()
+    {
+      auto result = rotl(s[1] * 5, 7) * 9;
+      auto t = s[1] << 17;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+      return result;
+    }
+    
+    // Advances the engine by 2^128 steps. Calling jump() k times on copies of an engine
+    //   gives non-overlapping streams for parallel use.
+    void jump()
+    {
+      static const uint64_t c_jump[] { 0x180E'C6D3'3CFD'0ABAull, 0xD5A6'1266'F0C9'392Cull,
+                                       0xA958'2618'E03F'C9AAull, 0x39AB'DC45'29B1'661Cull };
+      uint64_t t[4] {};
+      for (auto j : c_jump)
+        for (int b = 0; b < 64; ++b)
+        {
+          if (j & (1ull << b))
+            for (int i = 0; i < 4; ++i)
+              t[i] ^= s[i];
+          (*this)();
+        }
+      for (int i = 0; i < 4; ++i)
+        s[i] = t[i];
+    }
+  };
+  
+  namespace detail
+  {
+  
+    struct UInt128
+    {
+      uint64_t hi = 0;
+      uint64_t lo = 0;
+    };
+    
+    UInt128 mul_64x64(uint64_t a, uint64_t b)
+    {
+#ifdef __SIZEOF_INT128__
+      auto p = static_cast<unsigned __int128>(a) * b;
+      return { static_cast<uint64_t>(p >> 64), static_cast<uint64_t>(p) };
+#else
+      uint64_t a_lo = a & 0xFFFF'FFFF, a_hi = a >> 32;
+      uint64_t b_lo = b & 0xFFFF'FFFF, b_hi = b >> 32;
+      uint64_t p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+      uint64_t mid = (p0 >> 32) + (p1 & 0xFFFF'FFFF) + (p2 & 0xFFFF'FFFF);
+      return { p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32), (mid << 32) | (p0 & 0xFFFF'FFFF) };
+#endif
+    }
+    
+    // a * b + c mod 2^128.
+    UInt128 mul_add_128(const UInt128& a, const UInt128& b, const UInt128& c)
+    {
+      auto p = mul_64x64(a.lo, b.lo);
+      p.hi += a.lo * b.hi + a.hi * b.lo;
+      UInt128 r { p.hi + c.hi, p.lo + c.lo };
+      if (r.lo < p.lo)
+        r.hi++;
+      return r;
+    }
+    
+  }
+  
+  // PCG64 (XSL-RR 128/64) by Melissa O'Neill. 128 bits of state and 2^127 selectable streams,
+  //   e.g. one stream per thread with the same seed.
+  class PCG64
+  {
+    static constexpr detail::UInt128 c_multiplier { 0x2360'ED05'1FC6'5DA4ull, 0x4385'DF64'9FCC'F645ull };
+    detail::UInt128 state;
+    detail::UInt128 inc;
+    
+    void step() { state = detail::mul_add_128(state, c_multiplier, inc); }
+    
+  public:
+    using result_type = uint64_t;
+    
+    explicit PCG64(uint64_t seed = 0, uint64_t stream = 0) { this->seed(seed, stream); }
+    
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+    
+    void seed(uint64_t seed, uint64_t stream = 0)
+    {
+      SplitMix64 sm_seed(seed);
+      SplitMix64 sm_stream(~stream);
+      detail::UInt128 init_state { sm_seed(), sm_seed() };
+      detail::UInt128 init_seq { sm_stream(), sm_stream() };
+      inc = { (init_seq.hi << 1) | (init_seq.lo >> 63), (init_seq.lo << 1) | 1 };
+      state = {};
+      step();
+      state = detail::mul_add_128(state, { 0, 1 }, init_state);
+      step();
+    }
+    
+    result_type operator()()
+    {
+      step();
+      auto rot = static_cast<int>(state.hi >> 58);
+      auto xored = state.hi ^ state.lo;
+      return (xored >> rot) | (xored << ((64 - rot) & 63));
+    }
+  };
+  
+  // Four xoshiro256** engines stepped together for the bulk fill_*() functions. The state is stored
+  //   word by word across the lanes, so that each state word fills one AVX2 register or two SSE2
+  //   registers. Without SSE2 the lanes are stepped one at a time, with the same results.
+  // Lane l is Xoshiro256ss(seed) advanced by l + 1 jump()s, so no lane overlaps that engine or another
+  //   lane. The tail engine, advanced by five jumps, supplies the extra draws of rejection sampling.
+  class Xoshiro256ssX4
+  {
+  public:
+    static constexpr int c_num_lanes = 4;
+    
+  private:
+    alignas(32) uint64_t s[4][c_num_lanes] {};
+    Xoshiro256ss tail;
+    
+  public:
+    explicit Xoshiro256ssX4(uint64_t seed = 0) { this->seed(seed); }
+    
+    void seed(uint64_t seed)
+    {
+      Xoshiro256ss engine(seed);
+      for (int l = 0; l < c_num_lanes; ++l)
+      {
+        engine.jump();
+        for (int w = 0; w < 4; ++w)
+          s[w][l] = engine.s[w];
+      }
+      engine.jump();
+      tail = engine;
+    }
+    
+    // Writes the next output of lane l to out[l].
+    void next(uint64_t* out)
+    {
+#if defined(__AVX2__)
+      auto* st = reinterpret_cast<__m256i*>(s);
+      auto s0 = _mm256_load_si256(st + 0);
+      auto s1 = _mm256_load_si256(st + 1);
+      auto s2 = _mm256_load_si256(st + 2);
+      auto s3 = _mm256_load_si256(st + 3);
+      // rotl(s1 * 5, 7) * 9 with shifts and adds, since there is no 64 bit multiply.
+      auto x = _mm256_add_epi64(_mm256_slli_epi64(s1, 2), s1);
+      x = _mm256_or_si256(_mm256_slli_epi64(x, 7), _mm256_srli_epi64(x, 57));
+      auto result = _mm256_add_epi64(_mm256_slli_epi64(x, 3), x);
+      auto t = _mm256_slli_epi64(s1, 17);
+      s2 = _mm256_xor_si256(s2, s0);
+      s3 = _mm256_xor_si256(s3, s1);
+      s1 = _mm256_xor_si256(s1, s2);
+      s0 = _mm256_xor_si256(s0, s3);
+      s2 = _mm256_xor_si256(s2, t);
+      s3 = _mm256_or_si256(_mm256_slli_epi64(s3, 45), _mm256_srli_epi64(s3, 19));
+      _mm256_store_si256(st + 0, s0);
+      _mm256_store_si256(st + 1, s1);
+      _mm256_store_si256(st + 2, s2);
+      _mm256_store_si256(st + 3, s3);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), result);
+#elif defined(__SSE2__)
+      for (int h = 0; h < 2; ++h)
+      {
+        auto st = [this, h](int w) { return reinterpret_cast<__m128i*>(s[w]) + h; };
+        auto s0 = _mm_load_si128(st(0));
+        auto s1 = _mm_load_si128(st(1));
+        auto s2 = _mm_load_si128(st(2));
+        auto s3 = _mm_load_si128(st(3));
+        auto x = _mm_add_epi64(_mm_slli_epi64(s1, 2), s1);
+        x = _mm_or_si128(_mm_slli_epi64(x, 7), _mm_srli_epi64(x, 57));
+        auto result = _mm_add_epi64(_mm_slli_epi64(x, 3), x);
+        auto t = _mm_slli_epi64(s1, 17);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = _mm_or_si128(_mm_slli_epi64(s3, 45), _mm_srli_epi64(s3, 19));
+        _mm_store_si128(st(0), s0);
+        _mm_store_si128(st(1), s1);
+        _mm_store_si128(st(2), s2);
+        _mm_store_si128(st(3), s3);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + h, result);
+      }
+#else
+      for (int l = 0; l < c_num_lanes; ++l)
+      {
+        auto x = s[1][l] * 5;
+        out[l] = ((x << 7) | (x >> 57)) * 9;
+        auto t = s[1][l] << 17;
+        s[2][l] ^= s[0][l];
+        s[3][l] ^= s[1][l];
+        s[1][l] ^= s[2][l];
+        s[0][l] ^= s[3][l];
+        s[2][l] ^= t;
+        s[3][l] = (s[3][l] << 45) | (s[3][l] >> 19);
+      }
+#endif
+    }
+    
+    Xoshiro256ss& get_tail_engine() { return tail; }
+  };
+  
+  using DefaultEngine = Xoshiro256ss;
+  
+  namespace detail
+  {
+  
+    // Seed for engines of threads that have not called srand() themselves.
+    std::atomic<uint64_t>& base_seed()
+    {
+      static std::atomic<uint64_t> seed { 1 };
+      return seed;
+    }
+    
+    uint64_t next_thread_seed()
+    {
+      static std::atomic<uint64_t> num_threads { 0 };
+      return base_seed().load() + num_threads++;
+    }
+    
+    // The second variate from the last Box-Muller draw of randn() in the calling thread.
+    struct NormalCache
+    {
+      float y2 = 0.f;
+      bool use_last = false;
+    };
+    
+    NormalCache& normal_cache()
+    {
+      thread_local NormalCache cache;
+      return cache;
+    }
+    
+  }
+  
+  // The calling thread's engine used by the functions below that take no engine.
+  // A thread's engine is seeded when first used, from the last seed passed to srand() plus
+  //   the number of threads seeded before it. Since that order depends on the scheduling,
+  //   threads that need reproducible streams should call srand() or use their own engine.
+  DefaultEngine& default_engine()
+  {
+    thread_local DefaultEngine engine(detail::next_thread_seed());
+    return engine;
+  }
+  
+  // The calling thread's engine for the fill_*() functions that take no engine. Seeded like default_engine().
+  Xoshiro256ssX4& default_engine_x4()
+  {
+    thread_local Xoshiro256ssX4 engine(detail::next_thread_seed());
+    return engine;
+  }
+  
+  // Reseeds the calling thread's engine and sets the seed that new threads start from.
+  void srand(unsigned int seed)
+  {
+    detail::base_seed() = seed;
+    default_engine().seed(seed);
+    default_engine_x4().seed(seed);
+    detail::normal_cache().use_last = false;
+  }
+  
   unsigned int srand_time()
   {
     auto time_s = std::time(nullptr);
@@ -26,29 +350,45 @@ namespace rnd
     // Scale up seconds to higher units of time, to get more radical changes in p-random sequences.
     auto scaled_shifted_time_s = ui_shift_time_s * 3163; // Use prime number I guess.
     // Set seed.
-    std::srand(scaled_shifted_time_s);
+    srand(scaled_shifted_time_s);
     return scaled_shifted_time_s;
   }
   
-  // Silly wrapper for sake of completion.
-  void srand(unsigned int seed)
+  // Uniform random value in range [0, 1], from the top 24 bits of a 64-bit engine.
+  template<typename Engine>
+  float rand(Engine& engine)
   {
-    std::srand(seed);
+    static_assert(std::is_same_v<typename Engine::result_type, uint64_t>, "rnd needs a 64-bit engine.");
+    return static_cast<float>(engine() >> 40) * (1.f / static_cast<float>(0xFF'FFFF));
   }
   
   // Uniform random value in range [0, 1].
   float rand()
   {
-    auto r = static_cast<float>(std::rand());
-    return r / static_cast<float>(RAND_MAX);
+    return rand(default_engine());
+  }
+  
+  // Normal-distributed random value using the polar Box-Muller algorithm.
+  // Only one of the two variates is used, since the engine has no room to keep the other.
+  template<typename Engine>
+  float randn(Engine& engine, float mu, float sigma)
+  {
+    float x1, x2, w;
+    do
+    {
+      x1 = 2.0f * rand(engine) - 1.0f;
+      x2 = 2.0f * rand(engine) - 1.0f;
+      w = x1 * x1 + x2 * x2;
+    } while (w >= 1.0f || w == 0.0f);
+    return mu + x1 * std::sqrt((-2.0f * std::log(w)) / w) * sigma;
   }
 
   // Normal-distributed random value using the Box-Muller algorithm.
   float randn(float mu, float sigma)  /* normal random variate generator */
   {                       /* mean m, standard deviation s */
       float x1, x2, w, y1;
-      static float y2;
-      static bool use_last = false;
+      float& y2 = detail::normal_cache().y2;
+      bool& use_last = detail::normal_cache().use_last;
   
       if (use_last)               /* use value from previous call */
       {
@@ -61,7 +401,7 @@ namespace rnd
               x1 = 2.0f * rand() - 1.0f;
               x2 = 2.0f * rand() - 1.0f;
               w = x1 * x1 + x2 * x2;
-          } while ( w >= 1.0 );
+          } while ( w >= 1.0 || w == 0.0 );
   
           w = std::sqrt((-2.0f * std::log(w)) / w);
           y1 = x1 * w;
@@ -142,24 +482,52 @@ namespace rnd
   
   bool rand_bool()
   {
-    float t = rand();
-    return static_cast<bool>(std::round(t));
+    return (default_engine()() >> 63) != 0;
   }
   
-  float rand_float(float start, float end)
+  template<typename Engine>
+  float rand_float(Engine& engine, float start, float end)
   {
-    float t = rand();
+    float t = rand(engine);
     auto rnd = math::lerp(t, start, end);
     return rnd;
   }
   
+  float rand_float(float start, float end)
+  {
+    return rand_float(default_engine(), start, end);
+  }
+  
+  // Uniform integer in the closed range between start and end, in either order.
+  // Uses Lemire's multiply-and-reject method, so that every value is equally likely.
+  template<typename Engine>
+  int rand_int(Engine& engine, int start, int end)
+  {
+    static_assert(std::is_same_v<typename Engine::result_type, uint64_t>, "rnd needs a 64-bit engine.");
+    if (start > end)
+      std::swap(start, end);
+    auto range = static_cast<uint64_t>(static_cast<int64_t>(end) - start) + 1;
+    auto x = engine() >> 32;
+    if (range > 0xFFFF'FFFF)
+      return static_cast<int>(static_cast<int64_t>(start) + static_cast<int64_t>(x));
+    auto m = x * range;
+    auto l = static_cast<uint32_t>(m);
+    if (l < range)
+    {
+      auto threshold = static_cast<uint32_t>((0x1'0000'0000ull - range) % range);
+      while (l < threshold)
+      {
+        x = engine() >> 32;
+        m = x * range;
+        l = static_cast<uint32_t>(m);
+      }
+    }
+    return static_cast<int>(static_cast<int64_t>(start) + static_cast<int64_t>(m >> 32));
+  }
+  
   int rand_int(int start, int end)
   {
-    float t = rand();
-    auto rnd = math::lerp<float>(t,
-                                 static_cast<float>(start),
-                                 static_cast<float>(end));
-    return static_cast<int>(std::round(rnd));
+    return rand_int(default_engine(), start, end);
   }
   
   int rand_idx(size_t N)
@@ -169,14 +537,20 @@ namespace rnd
     return rand_int(0, static_cast<int>(N) - 1);
   }
   
-  template<typename T>
-  T rand_select(const std::vector<T>& values)
+  template<typename Engine, typename T>
+  T rand_select(Engine& engine, const std::vector<T>& values)
   {
     assert(!values.empty());
-    int idx = rand_idx(values.size());
+    int idx = rand_int(engine, 0, static_cast<int>(values.size()) - 1);
     return values[idx];
   }
   
+  template<typename T>
+  T rand_select(const std::vector<T>& values)
+  {
+    return rand_select(default_engine(), values);
+  }
+  
   template<typename T>
   T rand_select(const std::vector<std::pair<float, T>>& values)
   {
@@ -192,7 +566,7 @@ namespace rnd
         return vp.second;
       rnd -= vp.first;
     }
-
+    
     return values.back().second;
   }
   
@@ -212,7 +586,7 @@ namespace rnd
         return idx;
       rnd -= val;
     }
-
+    
     return N - 1;
   }
 
@@ -236,5 +610,273 @@ namespace rnd
   {
     return dice(N) == 1;
   }
+  
+  // //////////////
+  //  Bulk fills  //
+  // //////////////
+  
+  namespace detail
+  {
+  
+    // Word k in [0, 8) of a block of four 64-bit lane outputs, low half first,
+    //   i.e. the order in which SIMD code reads them as 32-bit lanes.
+    uint32_t block_word(const uint64_t* block, int k)
+    {
+      return static_cast<uint32_t>(block[k >> 1] >> (32 * (k & 1)));
+    }
+    
+    // Layers of the 128-layer ziggurat of Marsaglia and Tsang for the standard normal distribution.
+    struct Ziggurat
+    {
+      static constexpr double c_r = 3.442619855899;
+      uint32_t kn[128];
+      float wn[128];
+      float fn[128];
+      
+      Ziggurat()
+      {
+        const double m1 = 2147483648.0;
+        const double vn = 9.91256303526217e-3;
+        double dn = c_r;
+        double tn = dn;
+        double q = vn / std::exp(-0.5 * dn * dn);
+        kn[0] = static_cast<uint32_t>((dn / q) * m1);
+        kn[1] = 0;
+        wn[0] = static_cast<float>(q / m1);
+        wn[127] = static_cast<float>(dn / m1);
+        fn[0] = 1.f;
+        fn[127] = static_cast<float>(std::exp(-0.5 * dn * dn));
+        for (int i = 126; i >= 1; --i)
+        {
+          dn = std::sqrt(-2.0 * std::log(vn / dn + std::exp(-0.5 * dn * dn)));
+          kn[i + 1] = static_cast<uint32_t>((dn / tn) * m1);
+          tn = dn;
+          fn[i] = static_cast<float>(std::exp(-0.5 * dn * dn));
+          wn[i] = static_cast<float>(dn / m1);
+        }
+      }
+    };
+    
+    const Ziggurat& ziggurat()
+    {
+      static const Ziggurat zig;
+      return zig;
+    }
+    
+    // Standard normal value from the 64 random bits in x: the high half is the signed abscissa
+    //   and the low 7 bits pick the layer, so the two are independent.
+    // Rejected draws are redone with the bits of engine.
+    float ziggurat_normal(uint64_t x, const Ziggurat& zig, Xoshiro256ss& engine)
+    {
+      while (true)
+      {
+        auto j = static_cast<int32_t>(x >> 32);
+        auto iz = static_cast<uint32_t>(x & 127);
+        auto mag = j < 0 ? 0u - static_cast<uint32_t>(j) : static_cast<uint32_t>(j);
+        auto v = static_cast<float>(j) * zig.wn[iz];
+        if (mag < zig.kn[iz])
+          return v;
+        // Uniform in (0, 1).
+        auto uni = [&engine]() { return (static_cast<double>(engine() >> 11) + 0.5) * 0x1p-53; };
+        if (iz == 0)
+        {
+          // Base layer: sample the tail beyond c_r.
+          double tx = 0.0, ty = 0.0;
+          do
+          {
+            tx = -std::log(uni()) / Ziggurat::c_r;
+            ty = -std::log(uni());
+          } while (ty + ty < tx * tx);
+          return static_cast<float>(j > 0 ? Ziggurat::c_r + tx : -Ziggurat::c_r - tx);
+        }
+        if (zig.fn[iz] + uni() * (zig.fn[iz - 1] - zig.fn[iz]) < std::exp(-0.5 * v * v))
+          return v;
+        x = engine();
+      }
+    }
+    
+  }
+  
+  // Fills vals with uniform values in [lo, hi), eight at a time from 24 bits each of the four lanes.
+  void fill_uniform(Xoshiro256ssX4& engine, std::span<float> vals, float lo, float hi)
+  {
+    const float scale = (hi - lo) * 0x1p-24f;
+    alignas(32) uint64_t block[Xoshiro256ssX4::c_num_lanes];
+    float* out = vals.data();
+    const size_t N = vals.size();
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 v_scale = _mm256_set1_ps(scale);
+    const __m256 v_lo = _mm256_set1_ps(lo);
+#elif defined(__SSE2__)
+    const __m128 v_scale = _mm_set1_ps(scale);
+    const __m128 v_lo = _mm_set1_ps(lo);
+#endif
+    for (; i + 8 <= N; i += 8)
+    {
+      engine.next(block);
+#if defined(__AVX2__)
+      auto w = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+      auto u = _mm256_cvtepi32_ps(_mm256_srli_epi32(w, 8));
+      _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(u, v_scale), v_lo));
+#elif defined(__SSE2__)
+      for (int h = 0; h < 2; ++h)
+      {
+        auto w = _mm_load_si128(reinterpret_cast<const __m128i*>(block) + h);
+        auto u = _mm_cvtepi32_ps(_mm_srli_epi32(w, 8));
+        _mm_storeu_ps(out + i + 4*h, _mm_add_ps(_mm_mul_ps(u, v_scale), v_lo));
+      }
+#else
+      for (int k = 0; k < 8; ++k)
+        out[i + k] = static_cast<float>(detail::block_word(block, k) >> 8) * scale + lo;
+#endif
+    }
+    if (i < N)
+    {
+      engine.next(block);
+      for (int k = 0; i < N; ++i, ++k)
+        out[i] = static_cast<float>(detail::block_word(block, k) >> 8) * scale + lo;
+    }
+  }
+  
+  void fill_uniform(std::span<float> vals, float lo, float hi)
+  {
+    fill_uniform(default_engine_x4(), vals, lo, hi);
+  }
+  
+  // Fills vals with uniform integers in the closed range between start and end, in either order.
+  // Each value maps one 32-bit word with Lemire's method, eight at a time. The rare words that
+  //   would bias the result are redrawn from the tail engine.
+  void fill_int(Xoshiro256ssX4& engine, std::span<int> vals, int start, int end)
+  {
+    if (start > end)
+      std::swap(start, end);
+    const auto range64 = static_cast<uint64_t>(static_cast<int64_t>(end) - start) + 1;
+    const bool full_range = range64 > 0xFFFF'FFFF;
+    const auto range = static_cast<uint32_t>(range64);
+    const auto threshold = full_range ? 0u : static_cast<uint32_t>((0x1'0000'0000ull - range64) % range64);
+    auto map_word = [&](uint32_t w)
+    {
+      if (full_range)
+        return static_cast<int>(static_cast<int64_t>(start) + w);
+      auto m = static_cast<uint64_t>(w) * range;
+      while (static_cast<uint32_t>(m) < threshold)
+        m = (engine.get_tail_engine()() >> 32) * range;
+      return static_cast<int>(static_cast<int64_t>(start) + static_cast<int64_t>(m >> 32));
+    };
+    
+    alignas(32) uint64_t block[Xoshiro256ssX4::c_num_lanes];
+    int* out = vals.data();
+    const size_t N = vals.size();
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i v_start = _mm256_set1_epi32(start);
+    const __m256i v_range = _mm256_set1_epi64x(range);
+    // Unsigned compare through the signed one.
+    const __m256i v_sign = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m256i v_threshold = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(threshold)), v_sign);
+    const __m256i v_mask_lo = _mm256_set1_epi64x(0xFFFF'FFFF);
+    const __m256i v_mask_hi = _mm256_set1_epi64x(static_cast<int64_t>(0xFFFF'FFFF'0000'0000ull));
+#elif defined(__SSE2__)
+    const __m128i v_start = _mm_set1_epi32(start);
+    const __m128i v_range = _mm_set1_epi64x(range);
+    const __m128i v_sign = _mm_set1_epi32(std::numeric_limits<int32_t>::min());
+    const __m128i v_threshold = _mm_xor_si128(_mm_set1_epi32(static_cast<int32_t>(threshold)), v_sign);
+    const __m128i v_mask_lo = _mm_set1_epi64x(0xFFFF'FFFF);
+    const __m128i v_mask_hi = _mm_set1_epi64x(static_cast<int64_t>(0xFFFF'FFFF'0000'0000ull));
+#endif
+    for (; i + 8 <= N; i += 8)
+    {
+      engine.next(block);
+      [[maybe_unused]] bool rejected = true;
+#if defined(__AVX2__)
+      auto w = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+      if (full_range)
+      {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(w, v_start));
+        continue;
+      }
+      // 32 x 32 -> 64 bit products of the even and the odd words.
+      auto p_even = _mm256_mul_epu32(w, v_range);
+      auto p_odd = _mm256_mul_epu32(_mm256_srli_epi64(w, 32), v_range);
+      auto m_hi = _mm256_or_si256(_mm256_srli_epi64(p_even, 32), _mm256_and_si256(p_odd, v_mask_hi));
+      auto m_lo = _mm256_or_si256(_mm256_and_si256(p_even, v_mask_lo), _mm256_slli_epi64(p_odd, 32));
+      auto reject = _mm256_cmpgt_epi32(v_threshold, _mm256_xor_si256(m_lo, v_sign));
+      rejected = _mm256_movemask_epi8(reject) != 0;
+      if (!rejected)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(m_hi, v_start));
+#elif defined(__SSE2__)
+      if (full_range)
+      {
+        for (int h = 0; h < 2; ++h)
+        {
+          auto w = _mm_load_si128(reinterpret_cast<const __m128i*>(block) + h);
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i) + h, _mm_add_epi32(w, v_start));
+        }
+        continue;
+      }
+      __m128i m_hi[2];
+      int reject_mask = 0;
+      for (int h = 0; h < 2; ++h)
+      {
+        auto w = _mm_load_si128(reinterpret_cast<const __m128i*>(block) + h);
+        auto p_even = _mm_mul_epu32(w, v_range);
+        auto p_odd = _mm_mul_epu32(_mm_srli_epi64(w, 32), v_range);
+        m_hi[h] = _mm_or_si128(_mm_srli_epi64(p_even, 32), _mm_and_si128(p_odd, v_mask_hi));
+        auto m_lo = _mm_or_si128(_mm_and_si128(p_even, v_mask_lo), _mm_slli_epi64(p_odd, 32));
+        reject_mask |= _mm_movemask_epi8(_mm_cmpgt_epi32(v_threshold, _mm_xor_si128(m_lo, v_sign)));
+      }
+      rejected = reject_mask != 0;
+      if (!rejected)
+        for (int h = 0; h < 2; ++h)
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i) + h, _mm_add_epi32(m_hi[h], v_start));
+#endif
+      if (rejected)
+        for (int k = 0; k < 8; ++k)
+          out[i + k] = map_word(detail::block_word(block, k));
+    }
+    if (i < N)
+    {
+      engine.next(block);
+      for (int k = 0; i < N; ++i, ++k)
+        out[i] = map_word(detail::block_word(block, k));
+    }
+  }
+  
+  void fill_int(std::span<int> vals, int start, int end)
+  {
+    fill_int(default_engine_x4(), vals, start, end);
+  }
+  
+  // Fills vals with normal values, using a ziggurat on the 64 bits of each lane.
+  // The bits come from the SIMD lanes, four values at a time. The ziggurat accepts about 99% of them
+  //   with one table compare and one multiply, which stays scalar since SSE2 has no gathers.
+  void fill_normal(Xoshiro256ssX4& engine, std::span<float> vals, float mu, float sigma)
+  {
+    const auto& zig = detail::ziggurat();
+    alignas(32) uint64_t block[Xoshiro256ssX4::c_num_lanes];
+    float* out = vals.data();
+    const size_t N = vals.size();
+    for (size_t i = 0; i < N; i += Xoshiro256ssX4::c_num_lanes)
+    {
+      engine.next(block);
+      auto num = std::min<size_t>(Xoshiro256ssX4::c_num_lanes, N - i);
+      for (size_t l = 0; l < num; ++l)
+      {
+        // The common case of ziggurat_normal(), inlined.
+        auto j = static_cast<int32_t>(block[l] >> 32);
+        auto iz = static_cast<uint32_t>(block[l] & 127);
+        auto mag = j < 0 ? 0u - static_cast<uint32_t>(j) : static_cast<uint32_t>(j);
+        auto v = mag < zig.kn[iz] ? static_cast<float>(j) * zig.wn[iz]
+                                  : detail::ziggurat_normal(block[l], zig, engine.get_tail_engine());
+        out[i + l] = mu + sigma * v;
+      }
+    }
+  }
+  
+  void fill_normal(std::span<float> vals, float mu, float sigma)
+  {
+    fill_normal(default_engine_x4(), vals, mu, sigma);
+  }
 
 }
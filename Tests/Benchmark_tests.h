@@ -0,0 +1,416 @@
+//
+//  Benchmark_tests.h
+//  Core Lib
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "../Benchmark.h"
+#include "../Delay.h"
+#include <iostream>
+#include <thread>
+#include <filesystem>
+#include <cassert>
+
+namespace benchmark
+{
+
+  template<typename Clock>
+  void test_clock()
+  {
+    auto t0 = Clock::now_ns();
+    auto t1 = Clock::now_ns();
+    assert(t1 >= t0);
+    auto dt_ns = calc_time_ns<Clock>([]() { Delay::sleep(2'000); });
+    // Generous bounds: sleeps may overshoot on a loaded machine.
+    assert(dt_ns >= 1'000'000);
+    assert(dt_ns < 2'000'000'000);
+  }
+
+  void unit_tests()
+  {
+    // Clock policies.
+    test_clock<SteadyClock>();
+    test_clock<MonotonicRawClock>();
+    test_clock<TscClock>();
+    test_clock<TscpClock>();
+    
+    // calc_stats
+    {
+      std::vector<double> samples { 5, 1, 4, 2, 3 };
+      auto stats = calc_stats(samples, 10);
+      assert(stats.num_iterations == 10);
+      assert(stats.num_repetitions == 5);
+      assert(stats.min_ns == 1.0);
+      assert(stats.max_ns == 5.0);
+      assert(stats.median_ns == 3.0);
+      assert(stats.mean_ns == 3.0);
+      assert(math::is_eps(stats.p95_ns - 4.8, 1e-9));
+      assert(math::is_eps(stats.stddev_ns - std::sqrt(2.5), 1e-9));
+    }
+    {
+      auto stats = calc_stats({});
+      assert(stats.num_repetitions == 0);
+      assert(stats.mean_ns == 0.0);
+    }
+    
+    // measure
+    {
+      RunConfig cfg;
+      cfg.num_warmup = 1;
+      cfg.num_repetitions = 5;
+      cfg.min_repetition_time_ms = 0.1f;
+      float acc = 0.f;
+      auto stats = measure([&]() { acc = math::lerp(0.3f, acc, 1.f); return acc; }, cfg);
+      assert(stats.num_iterations >= 1);
+      assert(stats.num_repetitions == 5);
+      assert(stats.min_ns <= stats.median_ns);
+      assert(stats.median_ns <= stats.p99_ns);
+      assert(stats.p99_ns <= stats.max_ns);
+    }
+    {
+      RunConfig cfg;
+      cfg.num_iterations = 7;
+      cfg.num_repetitions = 3;
+      int calls = 0;
+      auto stats = measure([&]() { calls++; }, cfg);
+      assert(stats.num_iterations == 7);
+      assert(calls == 1 + 7 * (3 + cfg.num_warmup));
+    }
+    
+    // Integer ns accumulation.
+    {
+      BasicBenchmark<SteadyClock> bm;
+      bm.start("sleep");
+      Delay::sleep(1'000);
+      bm.stop("sleep");
+      assert(bm.get_time_ms("sleep") >= 0.5);
+      assert(bm.get_time_ms("missing") == 0.0);
+    }
+    
+    // Benchmark is a plain class, e.g. for data members.
+    {
+      struct Timed
+      {
+        Benchmark bm;
+      } timed;
+      static_assert(std::is_same_v<Benchmark, BasicBenchmark<DefaultClock>>);
+      timed.bm.set_print_on_destruction(false);
+      timed.bm.reg([]() {}, "member");
+      assert(timed.bm.get_num_calls("member") == 1);
+    }
+    
+    // Per-thread shards.
+    {
+      Benchmark bm;
+      const int num_threads = 4;
+      const int num_calls = 1000;
+      std::vector<std::thread> threads;
+      for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&bm]()
+        {
+          tic();
+          for (int i = 0; i < num_calls; ++i)
+          {
+            bm.start("worker");
+            do_not_optimize(i);
+            bm.stop("worker");
+          }
+          bm.reg([]() {}, "reg");
+          assert(toc_ns() >= 0);
+        });
+      for (auto& th : threads)
+        th.join();
+      assert(bm.get_num_calls("worker") == num_threads * num_calls);
+      assert(bm.get_num_calls("reg") == num_threads);
+    }
+    
+    // Sections that span more instances than a thread used to cache, also after other instances are gone.
+    {
+      for (int round = 0; round < 3; ++round)
+      {
+        std::vector<std::unique_ptr<Benchmark>> bms;
+        for (int b = 0; b < 40; ++b)
+        {
+          bms.emplace_back(std::make_unique<Benchmark>());
+          bms.back()->set_print_on_destruction(false);
+        }
+        for (auto& bm : bms)
+          bm->start("span");
+        for (auto& bm : bms)
+          bm->stop("span");
+        for (const auto& bm : bms)
+        {
+          assert(bm->get_num_shards() == 1);
+          assert(bm->get_num_calls("span") == 1);
+          assert(bm->get_time_ms("span") < 1'000.0);
+        }
+      }
+    }
+    
+    // Interned tags.
+    {
+      auto tag_a = BM_TAG("interned_a");
+      auto tag_b = BM_TAG("interned_b");
+      assert(tag_a.id != tag_b.id);
+      assert(BM_TAG("interned_a").id == tag_a.id);
+      assert(tag_registry().get_name(tag_b) == "interned_b");
+      
+      Benchmark bm;
+      for (int i = 0; i < 100; ++i)
+      {
+        bm.start(tag_a);
+        bm.stop(tag_a);
+      }
+      bm.reg([]() {}, tag_b);
+      assert(bm.get_timer(tag_a).num_calls == 100);
+      assert(bm.get_timer(tag_b).num_calls == 1);
+      // Tags interned after the shard was created grow it.
+      auto tag_c = BM_TAG("interned_c");
+      assert(bm.get_timer(tag_c).num_calls == 0);
+      bm.start(tag_c);
+      bm.stop(tag_c);
+      assert(bm.get_timer(tag_c).num_calls == 1);
+      assert(bm.get_timer(tag_a).num_calls == 100);
+    }
+    
+    // Hardware counters. Either available or gracefully disabled.
+    {
+      Benchmark bm;
+      bm.set_print_on_destruction(false);
+      bool available = bm.enable_hw_counters();
+      assert(available == local_perf_counters().is_available());
+      bm.reg([]()
+      {
+        float acc = 0.f;
+        for (int i = 0; i < 10'000; ++i)
+          do_not_optimize(acc += math::lerp(0.5f, acc, 1.f));
+      }, "hw_loop");
+      auto timer = bm.get_timer("hw_loop");
+      assert(timer.num_calls == 1);
+      if (available)
+        assert(timer.hw.cycles > 0 && timer.hw.instructions > 0);
+      else
+        assert(timer.hw.cycles == 0);
+    }
+    
+    // Allocation tracking.
+    {
+      Benchmark bm;
+      bm.set_print_on_destruction(false);
+      bool tracking = bm.enable_alloc_tracking();
+      assert(tracking == c_alloc_hooks_compiled);
+      std::vector<int> reserved;
+      reserved.reserve(100);
+      bm.reg([&reserved]()
+      {
+        for (int i = 0; i < 100; ++i)
+          reserved.emplace_back(i);
+      }, "no_alloc");
+      bm.reg([]()
+      {
+        auto* buf = new int[64];
+        do_not_optimize(buf);
+        delete[] buf;
+        auto str = std::make_unique<std::string>(100, 'x');
+        do_not_optimize(str);
+      }, "two_allocs");
+      auto tag = BM_TAG("interned_alloc");
+      bm.start(tag);
+      std::vector<double> vec(16);
+      do_not_optimize(vec);
+      bm.stop(tag);
+      if (c_alloc_hooks_compiled)
+      {
+        assert(bm.get_timer("no_alloc").alloc.num_allocs == 0);
+        auto two_allocs = bm.get_timer("two_allocs").alloc;
+        // The string body is a second heap block.
+        assert(two_allocs.num_allocs == 3);
+        assert(two_allocs.num_bytes >= 64*sizeof(int) + 100);
+        assert(bm.get_timer(tag).alloc.num_allocs == 1);
+        assert(bm.get_timer(tag).alloc.num_bytes == 16*sizeof(double));
+      }
+    }
+    
+    // Result files and baseline comparison.
+    {
+      Benchmark bm;
+      bm.set_print_on_destruction(false);
+      bm.start("a, \"quoted\" tag");
+      bm.stop("a, \"quoted\" tag");
+      RunConfig cfg;
+      cfg.num_iterations = 10;
+      cfg.num_repetitions = 3;
+      const auto& stats = bm.run([]() {}, "empty", cfg);
+      assert(stats.num_iterations == 10 && stats.num_repetitions == 3);
+      auto results = bm.collect_results();
+      assert(results.size() == 2);
+      
+      auto tmp_dir = std::filesystem::temp_directory_path();
+      for (const auto* ext : { ".json", ".csv" })
+      {
+        auto file_path = (tmp_dir / (std::string("core_benchmark_results") + ext)).string();
+        bool is_json = ext == std::string(".json");
+        bool written = is_json ? bm.write_json(file_path) : bm.write_csv(file_path);
+        assert(written);
+        std::vector<Result> loaded;
+        bool loaded_ok = load_results(file_path, loaded);
+        assert(loaded_ok);
+        assert(loaded.size() == results.size());
+        for (size_t r_idx = 0; r_idx < loaded.size(); ++r_idx)
+        {
+          assert(loaded[r_idx].tag == results[r_idx].tag);
+          assert(loaded[r_idx].kind == results[r_idx].kind);
+          assert(loaded[r_idx].num_calls == results[r_idx].num_calls);
+          assert(std::abs(loaded[r_idx].metric_ns() - results[r_idx].metric_ns()) <= 1e-5 * results[r_idx].metric_ns() + 1e-9);
+        }
+        std::filesystem::remove(file_path);
+      }
+      
+      // Non-finite stats and control characters in tags still give valid JSON.
+      {
+        Result odd;
+        odd.tag = "line\nbreak\x01";
+        odd.kind = "stats";
+        odd.mean_ns = std::numeric_limits<double>::quiet_NaN();
+        odd.stddev_ns = std::numeric_limits<double>::infinity();
+        auto json = to_json({ odd });
+        assert(json[2].find("\"line\\u000abreak\\u0001\"") != std::string::npos);
+        assert(json[2].find("\"mean_ns\": null") != std::string::npos);
+        assert(json[2].find("\"stddev_ns\": null") != std::string::npos);
+        for (const auto& l : json)
+          assert(std::none_of(l.begin(), l.end(), [](char c) { return static_cast<unsigned char>(c) < 0x20; }));
+        auto odd_loaded = detail::result_from_fields(detail::parse_flat_json_object(json[2]));
+        assert(odd_loaded.tag == odd.tag);
+        assert(std::isnan(odd_loaded.mean_ns) && std::isnan(odd_loaded.stddev_ns));
+      }
+      
+      auto slower = results;
+      for (auto& res : slower)
+      {
+        res.mean_ns *= 1.5;
+        res.median_ns *= 1.5;
+      }
+      auto cmps = compare_results(results, slower, 0.2);
+      assert(cmps.size() == 2);
+      assert(cmps[0].regression && cmps[1].regression);
+      cmps = compare_results(slower, results, 0.2);
+      assert(!cmps[0].regression && !cmps[1].regression);
+    }
+    
+    // Trace recorder.
+    {
+      trace_recorder().set_enabled(true);
+      {
+        Benchmark bm;
+        bm.set_print_on_destruction(false);
+        auto worker = [&bm]()
+        {
+          BM_SCOPE("traced_zone");
+          bm.start(BM_TAG("traced_tag"));
+          bm.stop(BM_TAG("traced_tag"));
+        };
+        std::thread th(worker);
+        worker();
+        th.join();
+      }
+      trace_recorder().set_enabled(false);
+      auto lines = trace_recorder().to_chrome_trace();
+      int num_begin = 0;
+      int num_end = 0;
+      for (const auto& l : lines)
+      {
+        if (l.find("\"ph\": \"B\"") != std::string::npos)
+          num_begin++;
+        if (l.find("\"ph\": \"E\"") != std::string::npos)
+          num_end++;
+      }
+      assert(num_begin == 4 && num_end == 4);
+      assert(lines.front() == "{" && lines.back() == "}");
+      assert(!lines[lines.size() - 3].ends_with(","));
+      assert(trace_recorder().get_num_dropped() == 0);
+      trace_recorder().clear();
+    }
+    
+    // Scoped zones.
+    {
+      auto sub_step = []()
+      {
+        BM_SCOPE("sub_step");
+        Delay::sleep(500);
+      };
+      auto frame = [&]()
+      {
+        BM_SCOPE("frame");
+        sub_step();
+        sub_step();
+      };
+      std::thread th(frame);
+      frame();
+      th.join();
+      
+      auto tree = zone_profiler().merge();
+      const auto& nodes = tree.get_nodes();
+      int frame_idx = -1;
+      int sub_step_idx = -1;
+      tree.visit([&](int idx, int depth)
+      {
+        if (depth == 0 && std::strcmp(nodes[idx].name, "frame") == 0)
+          frame_idx = idx;
+        else if (depth == 1 && std::strcmp(nodes[idx].name, "sub_step") == 0)
+          sub_step_idx = idx;
+      });
+      assert(frame_idx != -1 && sub_step_idx != -1);
+      assert(nodes[sub_step_idx].parent == frame_idx);
+      assert(nodes[frame_idx].num_calls == 2);
+      assert(nodes[sub_step_idx].num_calls == 4);
+      assert(nodes[frame_idx].inclusive_ns >= nodes[sub_step_idx].inclusive_ns);
+      assert(tree.exclusive_ns(frame_idx) == nodes[frame_idx].inclusive_ns - nodes[sub_step_idx].inclusive_ns);
+      for (const auto& l : zone_tree_lines(tree))
+        std::cout << l << std::endl;
+      zone_profiler().clear();
+      assert(zone_profiler().merge().empty());
+    }
+    
+    // Zones are only reported once, by whichever Benchmark prints first.
+    {
+      auto count_calls = [](const ZoneTree& tree, const char* name)
+      {
+        int64_t num_calls = 0;
+        tree.visit([&](int idx, int)
+        {
+          if (std::strcmp(tree.get_nodes()[idx].name, name) == 0)
+            num_calls += tree.get_nodes()[idx].num_calls;
+        });
+        return num_calls;
+      };
+      {
+        Benchmark bm_a;
+        Benchmark bm_b;
+        for (int i = 0; i < 3; ++i)
+        {
+          BM_SCOPE("reported_zone");
+        }
+        // bm_b prints first and takes the zones, then bm_a prints none.
+      }
+      assert(zone_profiler().take_unreported().empty());
+      {
+        BM_SCOPE("outer_zone");
+        {
+          BM_SCOPE("reported_zone");
+        }
+        auto unreported = zone_profiler().take_unreported();
+        // outer_zone is still open, but kept as the parent of the new call.
+        assert(count_calls(unreported, "reported_zone") == 1);
+        assert(count_calls(unreported, "outer_zone") == 0);
+      }
+      auto unreported = zone_profiler().take_unreported();
+      assert(count_calls(unreported, "outer_zone") == 1);
+      assert(count_calls(unreported, "reported_zone") == 0);
+      assert(count_calls(zone_profiler().merge(), "reported_zone") == 4);
+      zone_profiler().clear();
+    }
+  }
+
+}
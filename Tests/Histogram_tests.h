@@ -7,20 +7,375 @@
 
 #pragma once
 #include "../Histogram.h"
+#include "../HdrHistogram.h"
+#include "../ConcurrentHistogram.h"
+#include "../QuantileSketch.h"
+#include "../Histogram2D.h"
+#include <thread>
+#include <cassert>
 
 namespace hist
 {
 
   void unit_tests()
   {
-    Histogram<float> hist(100, -4, 10);
+    Histogram<float> hist(100, -4, 10, true);
+    Histogram<float> hist_counts(100, -4, 10);
+    std::vector<float> all_samples;
     for (int i = 0; i < 100'000; ++i)
-      hist += rnd::randn_clamp(0, 3, -4, 10);
+    {
+      auto s = rnd::randn_clamp(0, 3, -4, 10);
+      hist += s;
+      hist_counts += s;
+      all_samples.emplace_back(s);
+    }
     auto sb_hist = hist.to_stringbox(20, 80); //sh.num_cols());
     sb_hist.print();
     int num_outside = hist.sanity_check_bucket_samples();
     if (num_outside > 0)
       std::cerr << num_outside << " samples in the wrong bucket!" << std::endl;
+    assert(num_outside == 0);
+    
+    // Count-only mode bins exactly like the sample-retaining mode.
+    assert(!hist_counts.retains_samples());
+    assert(hist_counts.get_num_samples() == 100'000);
+    for (size_t b_idx = 0; b_idx < hist.get_num_buckets(); ++b_idx)
+    {
+      assert(hist_counts.get_count(b_idx) == hist.get_count(b_idx));
+      assert(hist_counts.get_bucket(b_idx).samples.empty());
+    }
+    
+    // Batch insertion bins exactly like operator+=, also at bucket edges and outside of the range.
+    {
+      Histogram<float> hist_batch(100, -4, 10);
+      hist_batch.add_samples(all_samples);
+      for (size_t b_idx = 0; b_idx < hist.get_num_buckets(); ++b_idx)
+        assert(hist_batch.get_count(b_idx) == hist.get_count(b_idx));
+      
+      std::vector<float> edge_samples { -4.5f, 10.5f, -4.f, 10.f, 1e30f, -1e30f };
+      for (size_t b_idx = 0; b_idx < hist.get_num_buckets(); ++b_idx)
+      {
+        const auto& buck = hist.get_bucket(b_idx);
+        for (float s : { buck.start, buck.end, std::nextafter(buck.start, -1e9f), std::nextafter(buck.end, 1e9f) })
+          edge_samples.emplace_back(s);
+      }
+      for (int r = 0; r < 3; ++r)
+      {
+        auto edge_samples_copy = edge_samples;
+        edge_samples.insert(edge_samples.end(), edge_samples_copy.begin(), edge_samples_copy.end());
+      }
+      Histogram<float> h_one(100, -4, 10);
+      Histogram<float> h_batch(100, -4, 10);
+      for (auto s : edge_samples)
+        h_one += s;
+      h_batch.add_samples(edge_samples);
+      assert(h_batch.get_num_underflow() == h_one.get_num_underflow());
+      assert(h_batch.get_num_overflow() == h_one.get_num_overflow());
+      for (size_t b_idx = 0; b_idx < h_one.get_num_buckets(); ++b_idx)
+        assert(h_batch.get_count(b_idx) == h_one.get_count(b_idx));
+      
+      // Bucket counts and ranges where rounding of the edges to float matters.
+      for (auto [N, start, end] : { std::tuple { 7, -4.f, 10.f }, { 1000, -1.f, 1.f }, { 12'345, 0.f, 3.f }, { 64, 1e6f, 1e6f + 1.f } })
+      {
+        Histogram<float> h_one_n(N, start, end), h_batch_n(N, start, end);
+        std::vector<float> samples_n;
+        for (int i = 0; i < 60'000; ++i)
+          samples_n.emplace_back(start + (end - start) * static_cast<float>(rnd::rand() * 1.2 - 0.1));
+        for (size_t b_idx = 0; b_idx < h_one_n.get_num_buckets(); b_idx += 3)
+          samples_n.emplace_back(h_one_n.get_bucket(b_idx).start);
+        for (auto s : samples_n)
+          h_one_n += s;
+        h_batch_n.add_samples(samples_n);
+        assert(h_batch_n.get_num_underflow() == h_one_n.get_num_underflow());
+        assert(h_batch_n.get_num_overflow() == h_one_n.get_num_overflow());
+        for (size_t b_idx = 0; b_idx < h_one_n.get_num_buckets(); ++b_idx)
+          assert(h_batch_n.get_count(b_idx) == h_one_n.get_count(b_idx));
+      }
+      
+      std::vector<double> doubles(edge_samples.begin(), edge_samples.end());
+      std::vector<int> ints;
+      for (int i = -50; i <= 150; ++i)
+        ints.emplace_back(i);
+      Histogram<double> hd_one(37, -4, 10), hd_batch(37, -4, 10);
+      Histogram<int> hi_one(10, 0, 100), hi_batch(10, 0, 100);
+      for (auto s : doubles)
+        hd_one += s;
+      for (auto s : ints)
+        hi_one += s;
+      hd_batch.add_samples(doubles);
+      hi_batch.add_samples(ints);
+      for (size_t b_idx = 0; b_idx < 37; ++b_idx)
+        assert(hd_batch.get_count(b_idx) == hd_one.get_count(b_idx));
+      for (size_t b_idx = 0; b_idx < 10; ++b_idx)
+        assert(hi_batch.get_count(b_idx) == hi_one.get_count(b_idx));
+      assert(hd_batch.get_num_samples() == doubles.size());
+      assert(hi_batch.get_num_overflow() == 50 && hi_batch.get_num_underflow() == 50);
+    }
+    
+    // Coarser views derived from the bucket counts match an exact re-binning when aligned.
+    {
+      auto counts = hist.rebin_counts(50, -4, 10);
+      auto hist_exact = hist;
+      hist_exact.resize(50, -4, 10);
+      for (size_t b_idx = 0; b_idx < 50; ++b_idx)
+        assert(counts[b_idx] == hist_exact.get_count(b_idx));
+      auto sb_0 = hist_counts.to_stringbox(10, 25);
+      auto sb_1 = hist_counts.to_stringbox(10, 25);
+      assert(sb_0.text_lines == sb_1.text_lines);
+      hist_counts += 9.99f;
+      assert(hist_counts.to_stringbox(10, 25).size() == 10);
+    }
+    
+    // Rendering re-buckets retained samples exactly, but spreads counts over the columns otherwise.
+    {
+      Histogram<float> h_retained(2, 0.f, 10.f, true);
+      Histogram<float> h_counts(2, 0.f, 10.f);
+      for (int i = 0; i < 5; ++i)
+      {
+        h_retained += 1.5f;
+        h_counts += 1.5f;
+      }
+      auto sb_retained = h_retained.to_stringbox(4, 10);
+      assert(sb_retained[3] == " #        ");
+      assert(sb_retained[0] == " #        ");
+      auto sb_counts = h_counts.to_stringbox(4, 10);
+      assert(sb_counts[3] == "#####     ");
+    }
+    
+    // Underflow / overflow.
+    {
+      Histogram<int> h(10, 0, 100);
+      for (int v : { -5, 0, 9, 10, 55, 100, 101 })
+        h += v;
+      assert(h.get_num_underflow() == 1);
+      assert(h.get_num_overflow() == 1);
+      assert(h.get_count(0) == 2);
+      assert(h.get_count(1) == 1);
+      assert(h.get_count(5) == 1);
+      assert(h.get_count(9) == 1);
+      assert(h.get_num_samples() == 7);
+    }
+    
+    // Count-only resize redistributes counts and preserves the total.
+    {
+      Histogram<float> h(100, 0.f, 1.f);
+      for (int i = 0; i < 1000; ++i)
+        h += (i + 0.5f) / 1000.f;
+      h.resize(10, 0.f, 1.f);
+      assert(h.get_num_samples() == 1000);
+      for (size_t b_idx = 0; b_idx < 10; ++b_idx)
+        assert(h.get_count(b_idx) == 100);
+      h.resize(5, 0.f, 0.5f);
+      assert(h.get_num_overflow() == 500);
+      assert(h.get_num_samples() == 1000);
+      assert(h.get_count(0) == 100);
+    }
+    
+    // Log-linear histogram: percentiles within the requested precision over a wide range.
+    {
+      HdrHistogram hdr(1, 3'600'000'000'000, 3);
+      for (int64_t v = 1; v <= 10'000; ++v)
+        hdr += v;
+      hdr += 100'000'000; // One 100 ms outlier among microsecond samples.
+      hdr += -1;
+      hdr += 4'000'000'000'000;
+      assert(hdr.get_total_count() == 10'001);
+      assert(hdr.get_num_underflow() == 1);
+      assert(hdr.get_num_overflow() == 1);
+      auto within = [](int64_t v, int64_t expected) { return std::abs(v - expected) <= expected / 1000; };
+      assert(within(hdr.get_value_at_percentile(50), 5'000));
+      assert(within(hdr.get_value_at_percentile(99), 9'900));
+      assert(within(hdr.get_value_at_percentile(99.9), 9'990));
+      assert(within(hdr.get_value_at_percentile(100), 100'000'000));
+      assert(hdr.get_min() == 1);
+      assert(hdr.get_max() == 100'000'000);
+      assert(hdr.values_are_equivalent(100'000'000, 100'000'001));
+      assert(!hdr.values_are_equivalent(1'000, 1'001));
+      
+      HdrHistogram hdr_1(1, 3'600'000'000'000, 3);
+      for (int64_t v = 10'001; v <= 20'000; ++v)
+        hdr_1 += v;
+      hdr.merge(hdr_1);
+      assert(hdr.get_total_count() == 20'001);
+      assert(within(hdr.get_value_at_percentile(50), 10'000));
+      
+      // Different layout: merged bucket by bucket at the coarser precision.
+      HdrHistogram hdr_2(1'000, 1'000'000'000, 2);
+      hdr_2.merge(hdr_1);
+      assert(hdr_2.get_total_count() == 10'000);
+      assert(std::abs(hdr_2.get_value_at_percentile(50) - 15'000) <= 1'000);
+      
+      auto sb = hdr.to_stringbox(10, 40);
+      assert(sb.size() == 10);
+      assert(sb[0].size() == 40);
+      sb.print();
+    }
+    
+    // Concurrent recording matches serial recording, also when snapshotting while writing.
+    {
+      ConcurrentHistogram<float> conc(100, -4.f, 10.f);
+      Histogram<float> serial(100, -4.f, 10.f);
+      const int num_threads = 4;
+      const int num_samples = 50'000;
+      auto sample = [](int t, int i) { return -5.f + 16.f * static_cast<float>((i * 7919 + t * 104'729) % 100'000) / 100'000.f; };
+      for (int t = 0; t < num_threads; ++t)
+        for (int i = 0; i < num_samples; ++i)
+          serial += sample(t, i);
+      
+      std::vector<std::thread> threads;
+      for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&conc, &sample, t, num_samples]()
+        {
+          for (int i = 0; i < num_samples; ++i)
+            conc += sample(t, i);
+        });
+      size_t prev_num_samples = 0;
+      for (int s = 0; s < 10; ++s)
+      {
+        auto num = conc.snapshot().get_num_samples();
+        assert(num >= prev_num_samples);
+        prev_num_samples = num;
+      }
+      for (auto& th : threads)
+        th.join();
+      assert(conc.get_num_shards() == num_threads);
+      
+      auto snap = conc.snapshot();
+      assert(snap.get_num_samples() == num_threads * num_samples);
+      assert(snap.get_num_underflow() == serial.get_num_underflow());
+      assert(snap.get_num_overflow() == serial.get_num_overflow());
+      for (size_t b_idx = 0; b_idx < snap.get_num_buckets(); ++b_idx)
+        assert(snap.get_count(b_idx) == serial.get_count(b_idx));
+      
+      Histogram<float> coarse(50, -4.f, 10.f);
+      assert(conc.merge_into(coarse));
+      assert(coarse.get_num_samples() == num_threads * num_samples);
+      for (size_t b_idx = 0; b_idx < 50; ++b_idx)
+        assert(coarse.get_count(b_idx) == serial.get_count(2*b_idx) + serial.get_count(2*b_idx + 1));
+      Histogram<float> retaining(100, -4.f, 10.f, true);
+      assert(!conc.merge_into(retaining));
+      
+      assert(conc.snapshot_and_reset().get_num_samples() == num_threads * num_samples);
+      assert(conc.snapshot().get_num_samples() == 0);
+      conc += 1.f;
+      assert(conc.snapshot().get_count(35) == 1);
+    }
+    
+    // One thread recording round-robin into more instances than it used to cache keeps one shard each,
+    //   also after other instances have come and gone.
+    {
+      for (int round = 0; round < 3; ++round)
+      {
+        std::vector<std::unique_ptr<ConcurrentHistogram<float>>> hists;
+        for (int h = 0; h < 40; ++h)
+          hists.emplace_back(std::make_unique<ConcurrentHistogram<float>>(10, 0.f, 10.f));
+        for (int i = 0; i < 100; ++i)
+          for (auto& hist : hists)
+            *hist += static_cast<float>(i % 10);
+        for (const auto& hist : hists)
+        {
+          assert(hist->get_num_shards() == 1);
+          assert(hist->snapshot().get_num_samples() == 100);
+        }
+      }
+    }
+    
+    // KLL sketch: bounded memory and ~1 % rank error on a stream without a known range, also when merged.
+    {
+      const int num_samples = 1'000'000;
+      std::vector<KllSketch<double>> sketches;
+      for (int t = 0; t < 4; ++t)
+        sketches.emplace_back(200, t + 1);
+      for (int i = 0; i < num_samples; ++i)
+        sketches[i % 4] += static_cast<double>((i * 7919ll) % num_samples); // Permutation of 0 .. N-1.
+      auto& kll = sketches[0];
+      assert(kll.get_num_samples() == num_samples / 4);
+      for (int t = 1; t < 4; ++t)
+        kll.merge(sketches[t]);
+      assert(kll.get_num_samples() == num_samples);
+      assert(kll.get_num_retained() < 1'000);
+      assert(kll.get_min() == 0.0);
+      assert(kll.get_max() == num_samples - 1);
+      for (double q : { 0.01, 0.25, 0.5, 0.9, 0.99 })
+      {
+        auto v = kll.get_quantile(q);
+        assert(std::abs(v / num_samples - q) < 0.02);
+        assert(std::abs(kll.get_rank(v) - q) < 0.02);
+      }
+      auto h = kll.to_histogram(10);
+      assert(h.get_num_samples() == num_samples);
+      for (size_t b_idx = 0; b_idx < 10; ++b_idx)
+        assert(std::abs(static_cast<double>(h.get_count(b_idx)) - num_samples / 10) < num_samples / 50);
+      assert(kll.to_stringbox(10, 40).size() == 10);
+    }
+    
+    // 2D histogram: cells, out of range samples and exact marginals.
+    {
+      Histogram2D<float> h2(10, 0.f, 10.f, 4, -2.f, 2.f);
+      h2.add(0.5f, -1.5f);
+      h2.add(9.5f, 1.5f);
+      h2.add(9.5f, 1.5f);
+      h2.add(-1.f, 0.5f); // x underflow.
+      h2.add(5.5f, 3.f); // y overflow.
+      assert(h2.get_count(0, 0) == 1);
+      assert(h2.get_count(9, 3) == 2);
+      assert(h2.get_num_samples() == 5);
+      assert(h2.get_num_outside() == 2);
+      
+      std::vector<float> xs, ys;
+      for (int i = 0; i < 10'000; ++i)
+      {
+        xs.emplace_back(rnd::randn_clamp(5, 2, -1, 11));
+        ys.emplace_back(rnd::randn_clamp(0, 1, -3, 3));
+      }
+      h2.add_samples(xs, ys);
+      Histogram<float> hx(10, 0.f, 10.f), hy(4, -2.f, 2.f);
+      for (float x : { 0.5f, 9.5f, 9.5f, -1.f, 5.5f })
+        hx += x;
+      for (float y : { -1.5f, 1.5f, 1.5f, 0.5f, 3.f })
+        hy += y;
+      hx.add_samples(xs);
+      hy.add_samples(ys);
+      auto mx = h2.marginal_x();
+      auto my = h2.marginal_y();
+      assert(mx.get_num_underflow() == hx.get_num_underflow() && mx.get_num_overflow() == hx.get_num_overflow());
+      assert(my.get_num_underflow() == hy.get_num_underflow() && my.get_num_overflow() == hy.get_num_overflow());
+      for (size_t b_idx = 0; b_idx < 10; ++b_idx)
+        assert(mx.get_count(b_idx) == hx.get_count(b_idx));
+      for (size_t b_idx = 0; b_idx < 4; ++b_idx)
+        assert(my.get_count(b_idx) == hy.get_count(b_idx));
+      
+      Histogram2D<float> h_peak(40, -4.f, 4.f, 20, -4.f, 4.f);
+      for (int i = 0; i < 10'000; ++i)
+        h_peak.add(rnd::randn(0.f, 1.f), rnd::randn(0.f, 1.f));
+      auto sb = h_peak.to_stringbox(10, 20);
+      sb.print();
+      assert(sb.size() == 10);
+      assert(sb[0].size() == 20);
+      assert(sb[4][9] == '@' || sb[5][10] == '@' || sb[4][10] == '@' || sb[5][9] == '@');
+      assert(sb[0][0] == ' ');
+      
+      // Batch insertion bins like add(), across several blocks.
+      Histogram2D<float> h2_one(10, 0.f, 10.f, 4, -2.f, 2.f);
+      Histogram2D<float> h2_batch(10, 0.f, 10.f, 4, -2.f, 2.f);
+      for (size_t i = 0; i < xs.size(); ++i)
+        h2_one.add(xs[i], ys[i]);
+      h2_batch.add_samples(xs, ys);
+      for (size_t y_idx = 0; y_idx < 4; ++y_idx)
+        for (size_t x_idx = 0; x_idx < 10; ++x_idx)
+          assert(h2_batch.get_count(x_idx, y_idx) == h2_one.get_count(x_idx, y_idx));
+      assert(h2_batch.get_num_samples() == xs.size());
+      
+      // More characters than buckets repeat each bucket instead of leaving rows and columns blank.
+      Histogram2D<float> h_coarse(2, 0.f, 2.f, 2, 0.f, 2.f);
+      h_coarse.add(0.5f, 0.5f);
+      h_coarse.add(1.5f, 0.5f);
+      h_coarse.add(0.5f, 1.5f);
+      h_coarse.add(1.5f, 1.5f);
+      auto sb_coarse = h_coarse.to_stringbox(4, 6);
+      for (int r_idx = 0; r_idx < 4; ++r_idx)
+        assert(sb_coarse[r_idx] == "@@@@@@");
+    }
   }
 
 }
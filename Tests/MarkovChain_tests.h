@@ -0,0 +1,377 @@
+//
+//  MarkovChain_tests.h
+//  Core Lib
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "../MarkovChain.h"
+#include "../TextIO.h"
+#include <filesystem>
+#include <cassert>
+
+namespace markov_chain
+{
+
+  void unit_tests()
+  {
+    // Training and the CSR layout.
+    {
+      MarkovChain<std::string> mc("");
+      mc.add_transitions({ "ka", "ro", "mi" });
+      mc.add_transitions({ "ka", "ro" });
+      mc.add_transitions({ "ka", "la" });
+      mc.add_transitions({ "ro", "mi" });
+      // "", ka, ro, mi, la.
+      assert(mc.get_num_states() == 5);
+      // ka->ro, ka->la, ro->mi, ro->"", mi->"", la->"" and from the start context to ka and ro.
+      assert(mc.get_num_transitions() == 8);
+      
+      auto raw = mc.get_transition_table();
+      assert(raw.size() == 4);
+      assert(raw.count("") == 0);
+      float ka_ro = 0.f;
+      for (const auto& [to, w] : raw.at("ka"))
+        if (to == "ro")
+          ka_ro = w;
+      assert(ka_ro == 2.f);
+      
+      assert(mc.generate() == "");
+      mc.normalize_transition_weights();
+      auto mctt = mc.get_transition_table();
+      assert(mctt.size() == 4);
+      const auto& ka = mctt.at("ka");
+      assert(ka.size() == 2);
+      // Sorted by ascending weight.
+      assert(ka[0].first == "la" && math::is_eps(ka[0].second - 1.f/3.f, 1e-6f));
+      assert(ka[1].first == "ro" && math::is_eps(ka[1].second - 2.f/3.f, 1e-6f));
+      for (const auto& [from, trgs] : mctt)
+      {
+        float tot = 0.f;
+        for (const auto& trg : trgs)
+          tot += trg.second;
+        assert(math::is_eps(tot - 1.f, 1e-6f));
+      }
+      
+      for (int i = 0; i < 200; ++i)
+      {
+        auto str = mc.generate(2, 3);
+        assert(str == "karomi" || str == "karo" || str == "kala" || str == "romi");
+      }
+      
+      // More training invalidates the layout until it is normalized again.
+      mc.add_transitions({ "mi", "la" });
+      assert(mc.generate() == "");
+      mc.normalize_transition_weights();
+      assert(mc.get_transition_table().at("mi").size() == 2);
+    }
+    
+    // Alias sampling follows the transition weights and the start counts.
+    {
+      MarkovChain<std::string> mc("");
+      for (int i = 0; i < 10; ++i)
+        mc.add_transitions({ "a", i < 1 ? "b" : (i < 3 ? "c" : "d") });
+      for (int i = 0; i < 3; ++i)
+        mc.add_transitions({ "x" });
+      mc.add_transitions({ "y" });
+      mc.normalize_transition_weights();
+      std::map<std::string, int> freqs;
+      const int num_samples = 40'000;
+      for (int i = 0; i < num_samples; ++i)
+        freqs[mc.generate()]++;
+      assert(freqs.size() == 5);
+      auto freq = [&](const std::string& str) { return static_cast<float>(freqs[str]) / num_samples; };
+      // Starts: a 10/14, x 3/14, y 1/14.
+      assert(math::is_eps(freq("ab") - 1.f/14.f, 0.01f));
+      assert(math::is_eps(freq("ac") - 2.f/14.f, 0.01f));
+      assert(math::is_eps(freq("ad") - 7.f/14.f, 0.015f));
+      assert(math::is_eps(freq("x") - 3.f/14.f, 0.01f));
+      assert(math::is_eps(freq("y") - 1.f/14.f, 0.01f));
+      
+      // The uniform start mode ignores the start counts and starts from any of a, b, c, d, x and y.
+      mc.set_start_mode(StartMode::Uniform);
+      freqs.clear();
+      for (int i = 0; i < num_samples; ++i)
+        freqs[mc.generate()]++;
+      assert(freqs.size() == 8);
+      assert(math::is_eps(freq("ab") + freq("ac") + freq("ad") - 1.f/6.f, 0.01f));
+      for (const auto* str : { "b", "c", "d", "x", "y" })
+        assert(math::is_eps(freq(str) - 1.f/6.f, 0.01f));
+      mc.set_start_mode(StartMode::StartCounts);
+      assert(mc.get_start_mode() == StartMode::StartCounts);
+    }
+    
+    // Indices reach the whole range, also beyond what a float can resolve.
+    {
+      rnd::Xoshiro256ss engine(7);
+      const uint32_t N = (1u << 26) + 3;
+      int low_bits[4] {};
+      const int num_samples = 40'000;
+      for (int i = 0; i < num_samples; ++i)
+      {
+        auto idx = detail::rand_index(engine, N);
+        assert(idx < N);
+        low_bits[idx & 3]++;
+      }
+      for (auto f : low_bits)
+        assert(math::is_eps(static_cast<float>(f) / num_samples - 0.25f, 0.015f));
+      for (int i = 0; i < 100; ++i)
+        assert(detail::rand_index(engine, 3) < 3);
+      assert(detail::rand_index(engine, 1) == 0);
+    }
+    
+    // Chunked, parallel import gives the same chain as adding the lines one by one.
+    {
+      static const std::vector<std::string> syllables { "ka", "ro", "mi", "sen", "tu", "la", "vor", "e" };
+      std::vector<std::string> lines;
+      MarkovChain<std::string> mc_seq_1("");
+      MarkovChain<std::string> mc_seq_3("", 3);
+      // About 3 MB, so that the file is split into several chunks.
+      for (int l_idx = 0; l_idx < 250'000; ++l_idx)
+      {
+        std::vector<std::string> words;
+        std::string line = l_idx % 7 == 0 ? " \t" : "";
+        for (int w_idx = 0; w_idx < 1 + (l_idx * 31) % 5; ++w_idx)
+        {
+          words.emplace_back(syllables[(l_idx * 13 + w_idx * 5) % syllables.size()]);
+          line += words.back() + "  ";
+        }
+        if (l_idx % 1'000 == 0)
+        {
+          words.clear();
+          line = "";
+        }
+        mc_seq_1.add_transitions(words);
+        mc_seq_3.add_transitions(words);
+        lines.emplace_back(line);
+      }
+      auto file_path = (std::filesystem::temp_directory_path() / "core_markov_chain_import.txt").string();
+      bool written = TextIO::write_file(file_path, lines);
+      assert(written);
+      
+      for (int num_threads : { 1, 3 })
+        for (auto* mc_seq : { &mc_seq_1, &mc_seq_3 })
+        {
+          MarkovChain<std::string> mc("", mc_seq->get_order());
+          ImportStats stats;
+          auto res = mc.import_transitions(file_path, num_threads, &stats);
+          assert(res == EXIT_SUCCESS);
+          assert(stats.num_lines == lines.size());
+          assert(stats.num_bytes == std::filesystem::file_size(file_path));
+          assert(stats.num_chunks > 1);
+          assert(stats.num_threads == num_threads);
+          assert(mc.get_num_states() == mc_seq->get_num_states());
+          assert(mc.get_num_contexts() == mc_seq->get_num_contexts());
+          assert(mc.get_num_transitions() == mc_seq->get_num_transitions());
+          mc.normalize_transition_weights();
+          mc_seq->normalize_transition_weights();
+          assert(mc.get_ngram_transition_table() == mc_seq->get_ngram_transition_table());
+          rnd::srand(42);
+          auto str = mc.generate(2, 4);
+          rnd::srand(42);
+          assert(str == mc_seq->generate(2, 4));
+        }
+      std::filesystem::remove(file_path);
+      
+      MarkovChain<std::string> mc("");
+      auto res = mc.import_transitions(file_path);
+      assert(res == EXIT_FAILURE);
+    }
+    
+    // Batches do not depend on the number of threads and report the sequences rejected for their length.
+    {
+      MarkovChain<std::string> mc("");
+      mc.add_transitions({ "ka", "ro", "mi" });
+      mc.add_transitions({ "ka", "ro" });
+      mc.add_transitions({ "ka", "la" });
+      mc.add_transitions({ "ro", "mi" });
+      std::vector<std::string> batch;
+      mc.generate_batch(batch, 100);
+      assert(batch.size() == 100);
+      assert(std::all_of(batch.begin(), batch.end(), [](const auto& str) { return str.empty(); }));
+      mc.normalize_transition_weights();
+      
+      GenerateStats stats_1, stats_3;
+      auto batch_1 = mc.generate_batch(10'000, 1, 3, 3, 7, &stats_1);
+      batch.resize(20'000, "unused");
+      mc.generate_batch(batch, 10'000, 3, 3, 3, 7, &stats_3);
+      assert(batch == batch_1);
+      assert(stats_1.num_draws == stats_3.num_draws);
+      assert(stats_1.num_sequences == 10'000);
+      assert(stats_3.num_threads == 3);
+      assert(std::all_of(batch.begin(), batch.end(), [](const auto& str) { return str == "karomi"; }));
+      // Only karomi is long enough: 3/4 * 2/3 * 2/3 = 1/3 of the draws.
+      assert(math::is_eps(static_cast<float>(stats_1.rejection_rate) - 2.f/3.f, 0.02f));
+      assert(stats_1.num_rejected + stats_1.num_sequences == stats_1.num_draws);
+      
+      auto batch_2 = mc.generate_batch(10'000, 2, -1, -1, 8);
+      assert(std::count(batch_2.begin(), batch_2.end(), "karomi") > 0);
+      assert(std::count(batch_2.begin(), batch_2.end(), "kala") > 0);
+      assert(mc.generate_batch(10'000, 2, -1, -1, 9) != batch_2);
+      
+      // Without a seed, every call gives a new batch, reproducible with rnd::srand().
+      rnd::srand(5);
+      auto batch_4 = mc.generate_batch(1'000, 2);
+      assert(mc.generate_batch(1'000, 2) != batch_4);
+      rnd::srand(5);
+      assert(mc.generate_batch(1'000, 1) == batch_4);
+    }
+    
+    // Higher orders only generate n-grams seen in training.
+    {
+      MarkovChain<std::string> mc_1("");
+      MarkovChain<std::string> mc_2("", 2);
+      for (auto* mc : { &mc_1, &mc_2 })
+      {
+        mc->add_transitions({ "a", "b", "c" });
+        mc->add_transitions({ "x", "b", "d" });
+        mc->normalize_transition_weights();
+      }
+      assert(mc_2.get_order() == 2);
+      // Start, a, ab, bc, x, xb, bd.
+      assert(mc_2.get_num_contexts() == 7);
+      assert(mc_2.get_transition_table().empty());
+      auto table = mc_2.get_ngram_transition_table();
+      assert(table.size() == 7);
+      const auto& start = table.at({ "", "" });
+      assert(start.size() == 2);
+      assert(math::is_eps(start[0].second - 0.5f, 1e-6f));
+      assert(table.at({ "a", "b" }).size() == 1);
+      assert(table.at({ "a", "b" })[0].first == "c");
+      
+      std::map<std::string, int> freqs_1, freqs_2;
+      for (int i = 0; i < 1'000; ++i)
+      {
+        freqs_1[mc_1.generate()]++;
+        freqs_2[mc_2.generate()]++;
+      }
+      assert(freqs_1.size() == 4);
+      assert(freqs_1.count("abd") == 1);
+      assert(freqs_2.size() == 2);
+      assert(freqs_2.count("abc") == 1);
+      assert(freqs_2.count("xbd") == 1);
+      
+      // Starting from any context emits all of its items, not just the last one.
+      mc_2.set_start_mode(StartMode::Uniform);
+      freqs_2.clear();
+      for (int i = 0; i < 1'000; ++i)
+        freqs_2[mc_2.generate()]++;
+      assert(freqs_2.size() == 4);
+      for (const auto* str : { "abc", "bc", "xbd", "bd" })
+        assert(freqs_2.count(str) == 1);
+      for (int i = 0; i < 100; ++i)
+        assert(mc_2.generate_sequence(3, 3).size() == 3);
+    }
+    
+    // Items that do not concatenate.
+    {
+      MarkovChain<int> mc(-1, 3);
+      for (int s = 0; s < 10; ++s)
+      {
+        std::vector<int> sequence;
+        for (int i = 0; i < 5; ++i)
+          sequence.emplace_back((s + i) % 7);
+        mc.add_transitions(sequence);
+      }
+      mc.normalize_transition_weights();
+      for (int i = 0; i < 100; ++i)
+      {
+        auto sequence = mc.generate_sequence(5, 5);
+        assert(sequence.size() == 5);
+        for (size_t j = 1; j < sequence.size(); ++j)
+          assert(sequence[j] == (sequence[j - 1] + 1) % 7);
+      }
+    }
+    
+    // Snapshots generate the same as the chain they were saved from and can be trained further.
+    {
+      auto file_path = (std::filesystem::temp_directory_path() / "core_markov_chain_snapshot.bin").string();
+      MarkovChain<std::string> mc("", 2);
+      mc.add_transitions({ "ka", "ro", "mi" });
+      mc.add_transitions({ "ka", "ro", "la" });
+      mc.add_transitions({ "sen", "tu" });
+      assert(mc.save_snapshot(file_path) == EXIT_FAILURE);
+      mc.normalize_transition_weights();
+      assert(mc.save_snapshot(file_path) == EXIT_SUCCESS);
+      
+      MarkovChain<std::string> mc_snap("-");
+      assert(mc_snap.load_snapshot(file_path) == EXIT_SUCCESS);
+      assert(mc_snap.is_normalized());
+      assert(mc_snap.get_order() == 2);
+      assert(mc_snap.empty_item == "");
+      assert(mc_snap.get_num_states() == mc.get_num_states());
+      assert(mc_snap.get_num_contexts() == mc.get_num_contexts());
+      assert(mc_snap.get_num_transitions() == mc.get_num_transitions());
+      assert(mc_snap.get_ngram_transition_table() == mc.get_ngram_transition_table());
+      for (int i = 0; i < 20; ++i)
+      {
+        rnd::srand(i);
+        auto str = mc.generate(1, 4);
+        rnd::srand(i);
+        assert(str == mc_snap.generate(1, 4));
+      }
+      
+      mc.add_transitions({ "ka", "la" });
+      mc_snap.add_transitions({ "ka", "la" });
+      assert(!mc_snap.is_normalized());
+      assert(mc_snap.get_num_transitions() == mc.get_num_transitions());
+      mc.normalize_transition_weights();
+      mc_snap.normalize_transition_weights();
+      assert(mc_snap.get_ngram_transition_table() == mc.get_ngram_transition_table());
+      
+      MarkovChain<int> mc_int(-1);
+      assert(mc_int.load_snapshot(file_path) == EXIT_FAILURE);
+      mc_int.add_transitions({ 1, 2, 3 });
+      mc_int.normalize_transition_weights();
+      assert(mc_int.save_snapshot(file_path) == EXIT_SUCCESS);
+      MarkovChain<int> mc_int_snap(0, 3);
+      assert(mc_int_snap.load_snapshot(file_path) == EXIT_SUCCESS);
+      assert(mc_int_snap.empty_item == -1);
+      assert(mc_int_snap.get_transition_table() == mc_int.get_transition_table());
+      assert(mc_int_snap.generate_sequence(3, 3) == std::vector<int>({ 1, 2, 3 }));
+      
+      // Out of range indices.
+      {
+        std::ifstream fin(file_path, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        fin.close();
+        detail::SnapshotHeader header;
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        auto corrupt_path = file_path + ".corrupt";
+        for (auto sec : { detail::SnapshotSection::TargetItems, detail::SnapshotSection::NextContexts,
+                          detail::SnapshotSection::AliasSlots })
+        {
+          auto corrupt = bytes;
+          uint32_t bad_idx = 1'000'000;
+          std::memcpy(corrupt.data() + header.section_offsets[static_cast<size_t>(sec)], &bad_idx, sizeof(bad_idx));
+          std::ofstream fout(corrupt_path, std::ios::binary);
+          fout.write(corrupt.data(), static_cast<std::streamsize>(corrupt.size()));
+          fout.close();
+          assert(mc_int_snap.load_snapshot(corrupt_path) == EXIT_FAILURE);
+        }
+        std::filesystem::remove(corrupt_path);
+        assert(mc_int_snap.generate_sequence(3, 3) == std::vector<int>({ 1, 2, 3 }));
+      }
+      
+      // Truncated file.
+      std::filesystem::resize_file(file_path, std::filesystem::file_size(file_path) - 8);
+      assert(mc_int_snap.load_snapshot(file_path) == EXIT_FAILURE);
+      assert(mc_int_snap.get_num_states() == mc_int.get_num_states());
+      std::filesystem::remove(file_path);
+    }
+    
+    // High fan-out.
+    {
+      MarkovChain<int> mc(-1);
+      for (int i = 0; i < 10'000; ++i)
+        mc.add_transition(0, i % 1'000 + 1);
+      mc.normalize_transition_weights();
+      assert(mc.get_num_states() == 1'002);
+      auto mctt = mc.get_transition_table();
+      assert(mctt.at(0).size() == 1'000);
+      assert(math::is_eps(mctt.at(0).front().second - 1e-3f, 1e-7f));
+    }
+  }
+
+}
@@ -0,0 +1,180 @@
+//
+//  Rand_tests.h
+//  Core Lib
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "../Rand.h"
+#include <random>
+#include <thread>
+#include <cassert>
+
+namespace rnd
+{
+
+  void unit_tests()
+  {
+    // Engines.
+    {
+      SplitMix64 sm(0);
+      assert(sm() == 0xE220'A839'7B1D'CDAFull);
+      
+      Xoshiro256ss xo_a(5), xo_b(5), xo_c(6);
+      for (int i = 0; i < 100; ++i)
+        assert(xo_a() == xo_b());
+      assert(xo_a() != xo_c());
+      auto xo_jumped = xo_a;
+      xo_jumped.jump();
+      assert(xo_jumped() != xo_a());
+      
+      PCG64 pcg_a(5), pcg_b(5), pcg_c(5, 1);
+      for (int i = 0; i < 100; ++i)
+        assert(pcg_a() == pcg_b());
+      assert(pcg_a() != pcg_c());
+      
+      // Usable with <random>.
+      std::uniform_int_distribution<int> dist(1, 6);
+      auto d = dist(pcg_a);
+      assert(1 <= d && d <= 6);
+      
+      double sum_xo = 0.0, sum_pcg = 0.0;
+      const int num_samples = 100'000;
+      for (int i = 0; i < num_samples; ++i)
+      {
+        auto r_xo = rand(xo_a);
+        auto r_pcg = rand(pcg_a);
+        assert(0.f <= r_xo && r_xo <= 1.f);
+        assert(0.f <= r_pcg && r_pcg <= 1.f);
+        sum_xo += r_xo;
+        sum_pcg += r_pcg;
+      }
+      assert(math::is_eps(static_cast<float>(sum_xo / num_samples) - 0.5f, 0.005f));
+      assert(math::is_eps(static_cast<float>(sum_pcg / num_samples) - 0.5f, 0.005f));
+    }
+    
+    // srand() makes the calling thread reproducible, also in other threads.
+    {
+      auto draw = []()
+      {
+        std::vector<int> values;
+        for (int i = 0; i < 20; ++i)
+          values.emplace_back(rand_int(0, 1'000'000));
+        values.emplace_back(static_cast<int>(randn(0.f, 1e3f)));
+        return values;
+      };
+      srand(42);
+      auto values = draw();
+      srand(42);
+      assert(draw() == values);
+      std::vector<int> thread_values;
+      std::thread th([&]() { srand(42); thread_values = draw(); });
+      th.join();
+      assert(thread_values == values);
+      srand(43);
+      assert(draw() != values);
+    }
+    
+    // rand_int() is uniform, including the end points.
+    {
+      Xoshiro256ss engine(1);
+      int freqs[3] {};
+      const int num_samples = 30'000;
+      for (int i = 0; i < num_samples; ++i)
+        freqs[rand_int(engine, 2, 0)]++;
+      for (auto f : freqs)
+        assert(math::is_eps(static_cast<float>(f) / num_samples - 1.f/3.f, 0.01f));
+      
+      for (int i = 0; i < 1'000; ++i)
+      {
+        auto r = rand_int(engine, -5, -3);
+        assert(-5 <= r && r <= -3);
+      }
+      assert(rand_int(engine, 7, 7) == 7);
+      rand_int(engine, std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+      
+      std::vector<std::string> values { "a", "b" };
+      auto v = rand_select(engine, values);
+      assert(v == "a" || v == "b");
+    }
+    
+    // The lanes of the bulk engine are jumped copies of the scalar engine.
+    {
+      Xoshiro256ssX4 engine_x4(3);
+      Xoshiro256ss engine(3);
+      std::vector<Xoshiro256ss> lanes;
+      for (int l = 0; l < Xoshiro256ssX4::c_num_lanes; ++l)
+      {
+        engine.jump();
+        lanes.emplace_back(engine);
+      }
+      alignas(32) uint64_t block[Xoshiro256ssX4::c_num_lanes];
+      for (int i = 0; i < 100; ++i)
+      {
+        engine_x4.next(block);
+        for (int l = 0; l < Xoshiro256ssX4::c_num_lanes; ++l)
+          assert(block[l] == lanes[l]());
+      }
+    }
+    
+    // Bulk fills, with sizes that are not multiples of the SIMD width.
+    {
+      std::vector<float> vals(100'003);
+      srand(5);
+      fill_uniform(vals, -2.f, 5.f);
+      auto copy = vals;
+      srand(5);
+      fill_uniform(vals, -2.f, 5.f);
+      assert(vals == copy);
+      double sum = 0.0;
+      for (auto v : vals)
+      {
+        assert(-2.f <= v && v <= 5.f);
+        sum += v;
+      }
+      assert(math::is_eps(static_cast<float>(sum / vals.size()) - 1.5f, 0.02f));
+      
+      Xoshiro256ssX4 engine(11);
+      fill_normal(engine, vals, 1.f, 2.f);
+      double mean = 0.0;
+      for (auto v : vals)
+        mean += v;
+      mean /= vals.size();
+      double var = 0.0;
+      size_t num_outside_3_sigma = 0;
+      for (auto v : vals)
+      {
+        var += (v - mean) * (v - mean);
+        if (std::abs(v - 1.f) > 6.f)
+          num_outside_3_sigma++;
+      }
+      assert(math::is_eps(static_cast<float>(mean) - 1.f, 0.03f));
+      assert(math::is_eps(static_cast<float>(std::sqrt(var / vals.size())) - 2.f, 0.03f));
+      // 0.27% are expected outside of 3 sigma.
+      assert(200 < num_outside_3_sigma && num_outside_3_sigma < 350);
+      
+      std::vector<int> ints(70'001);
+      fill_int(engine, ints, 3, -3);
+      int freqs[7] {};
+      for (auto v : ints)
+      {
+        assert(-3 <= v && v <= 3);
+        freqs[v + 3]++;
+      }
+      for (auto f : freqs)
+        assert(math::is_eps(static_cast<float>(f) / ints.size() - 1.f/7.f, 0.01f));
+      // Often rejected words.
+      fill_int(engine, ints, 0, 1'500'000'000);
+      for (auto v : ints)
+        assert(0 <= v && v <= 1'500'000'000);
+      fill_int(engine, ints, std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+      assert(std::count(ints.begin(), ints.end(), ints.front()) < 3);
+      
+      std::vector<float> empty;
+      fill_uniform(empty, 0.f, 1.f);
+      fill_normal(empty, 0.f, 1.f);
+    }
+  }
+
+}
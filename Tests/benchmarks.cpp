@@ -0,0 +1,458 @@
+//
+//  benchmarks.cpp
+//  Core
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+//  Usage: benchmarks [--json <file>] [--csv <file>] [--baseline <file>] [--threshold <fraction>]
+//  Exits with 1 if --baseline is given and any benchmark regressed by more than the threshold.
+//
+
+#include "../Benchmark.h"
+#include "../Rand.h"
+#include "../Math.h"
+#include "../StlUtils.h"
+#include "../StringHelper.h"
+#include "../DateTime.h"
+#include "../Histogram.h"
+#include "../HdrHistogram.h"
+#include "../ConcurrentHistogram.h"
+#include "../QuantileSketch.h"
+#include "../Histogram2D.h"
+#include "../MarkovChain.h"
+#include "../TextIO.h"
+#include <charconv>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using benchmark::Benchmark;
+
+namespace
+{
+
+  const std::vector<int> c_sizes { 100, 10'000, 1'000'000 };
+  
+  // Set by --smoke: only the smallest size of each benchmark, timed for a single iteration,
+  //   so that CI can check that the suite still runs without waiting for the numbers.
+  bool smoke_run = false;
+  
+  std::vector<int> sizes(const std::vector<int>& all_sizes)
+  {
+    return smoke_run ? std::vector<int> { all_sizes.front() } : all_sizes;
+  }
+  
+  std::string sized_tag(const std::string& name, int N)
+  {
+    return name + " / " + std::to_string(N);
+  }
+  
+  benchmark::RunConfig base_config()
+  {
+    benchmark::RunConfig cfg;
+    if (smoke_run)
+    {
+      cfg.num_warmup = 0;
+      cfg.num_repetitions = 2;
+      cfg.num_iterations = 1;
+    }
+    return cfg;
+  }
+  
+  // Large inputs take long per call, so require fewer repetitions of them.
+  benchmark::RunConfig sized_config(int N)
+  {
+    auto cfg = base_config();
+    if (!smoke_run && N >= 1'000'000)
+    {
+      cfg.num_warmup = 1;
+      cfg.num_repetitions = 5;
+      cfg.min_repetition_time_ms = 0.f;
+    }
+    return cfg;
+  }
+  
+  std::vector<float> make_floats(int N)
+  {
+    std::vector<float> values(N);
+    for (auto& v : values)
+      v = rnd::rand_float(-4.f, 10.f);
+    return values;
+  }
+
+  void bm_rand(Benchmark& bm)
+  {
+    bm.run([]() { return rnd::rand(); }, "rnd::rand", base_config());
+    bm.run([]() { return rnd::randn(0.f, 1.f); }, "rnd::randn", base_config());
+    bm.run([]() { return rnd::rand_int(0, 100); }, "rnd::rand_int", base_config());
+    bm.run([]() { return rnd::randn_clamp(0.f, 3.f, -4.f, 10.f); }, "rnd::randn_clamp", base_config());
+    for (int N : sizes(c_sizes))
+    {
+      std::vector<float> values(N);
+      bm.run([&values]()
+      {
+        for (auto& v : values)
+          v = rnd::rand_float(0.f, 1.f);
+        benchmark::do_not_optimize(values.data());
+      }, sized_tag("rnd::rand_float fill", N), sized_config(N));
+      bm.run([&values]()
+      {
+        for (auto& v : values)
+          v = rnd::randn(0.f, 1.f);
+        benchmark::do_not_optimize(values.data());
+      }, sized_tag("rnd::randn fill", N), sized_config(N));
+      bm.run([&values]()
+      {
+        rnd::fill_uniform(values, 0.f, 1.f);
+        benchmark::do_not_optimize(values.data());
+      }, sized_tag("rnd::fill_uniform", N), sized_config(N));
+      bm.run([&values]()
+      {
+        rnd::fill_normal(values, 0.f, 1.f);
+        benchmark::do_not_optimize(values.data());
+      }, sized_tag("rnd::fill_normal", N), sized_config(N));
+      std::vector<int> ints(N);
+      bm.run([&ints]()
+      {
+        rnd::fill_int(ints, 0, 100);
+        benchmark::do_not_optimize(ints.data());
+      }, sized_tag("rnd::fill_int", N), sized_config(N));
+      
+      std::vector<std::pair<float, int>> weighted;
+      for (int i = 0; i < std::min(N, 10'000); ++i)
+        weighted.emplace_back(rnd::rand(), i);
+      bm.run([&weighted]() { return rnd::rand_select(weighted); },
+             sized_tag("rnd::rand_select weighted", static_cast<int>(weighted.size())), base_config());
+    }
+  }
+  
+  void bm_math(Benchmark& bm)
+  {
+    float t = 0.3f;
+    float a = 1.f;
+    bm.run([&]() { benchmark::do_not_optimize(t); return math::lerp(t, a, 2.f); }, "math::lerp", base_config());
+    bm.run([&]() { benchmark::do_not_optimize(a); return math::linmap_clamped(a, 0.f, 2.f, -1.f, 1.f); }, "math::linmap_clamped", base_config());
+    bm.run([&]() { benchmark::do_not_optimize(a); return math::value_to_param(a, -4.f, 10.f); }, "math::value_to_param", base_config());
+    bm.run([&]() { benchmark::do_not_optimize(a); return math::distance(a, t, 3.f, 4.f); }, "math::distance", base_config());
+    for (int N : sizes(c_sizes))
+      bm.run([N]() { return math::linspace(0.f, 1.f / N, 1.f); }, sized_tag("math::linspace", N), sized_config(N));
+  }
+  
+  void bm_stlutils(Benchmark& bm)
+  {
+    for (int N : sizes(c_sizes))
+    {
+      auto values = make_floats(N);
+      auto cfg = sized_config(N);
+      bm.run([&values]() { return stlutils::sum(values); }, sized_tag("stlutils::sum", N), cfg);
+      bm.run([&values]() { return stlutils::max_element_idx(values); }, sized_tag("stlutils::max_element_idx", N), cfg);
+      bm.run([&values]() { return stlutils::count_if(values, [](float v) { return v > 0.f; }); },
+             sized_tag("stlutils::count_if", N), cfg);
+      auto sorted = values;
+      bm.run([&sorted, &values]() { sorted = values; stlutils::sort(sorted); },
+             sized_tag("stlutils::sort", N), cfg);
+    }
+  }
+  
+  void bm_string_helper(Benchmark& bm)
+  {
+    bm.run([]() { return str::adjust_str("benchmark", str::Adjustment::Center, 40); }, "str::adjust_str", base_config());
+    bm.run([]() { return str::to_upper(std::string("Core-Lib benchmark")); }, "str::to_upper", base_config());
+    for (int N : sizes(c_sizes))
+    {
+      std::string text;
+      for (int i = 0; i < N; ++i)
+        text += (i % 7 == 0) ? ' ' : static_cast<char>('a' + i % 26);
+      bm.run([&text]() { return str::tokenize(text, { ' ' }); }, sized_tag("str::tokenize", N), sized_config(N));
+    }
+  }
+  
+  void bm_datetime(Benchmark& bm)
+  {
+    datetime::DateTime dt(2024, 10, 31, 13, 37, 42);
+    bm.run([&dt]() { return datetime::get_datetime_str(dt); }, "datetime::get_datetime_str", base_config());
+    bm.run([&dt]() { return datetime::get_datetime_str(dt, "%e %B %Y, %I:%M %p"); }, "datetime::get_datetime_str long", base_config());
+    bm.run([&dt]() { auto d = dt; d.add_seconds(12'345.6); return d.to_days(); }, "datetime::DateTime::add_seconds", base_config());
+  }
+  
+  void bm_histogram(Benchmark& bm)
+  {
+    for (int N : sizes(c_sizes))
+    {
+      auto values = make_floats(N);
+      auto cfg = sized_config(N);
+      bm.run([&values]()
+      {
+        hist::Histogram<float> h(100, -4.f, 10.f);
+        for (auto v : values)
+          h += v;
+        return h.get_num_samples();
+      }, sized_tag("hist::Histogram add", N), cfg);
+      bm.run([&values]()
+      {
+        hist::Histogram<float> h(100, -4.f, 10.f);
+        h.add_samples(values);
+        return h.get_num_samples();
+      }, sized_tag("hist::Histogram add_samples", N), cfg);
+      bm.run([&values]()
+      {
+        hist::Histogram2D<float> h(100, -4.f, 10.f, 50, -4.f, 10.f);
+        std::span<const float> xs(values);
+        h.add_samples(xs.subspan(1), xs);
+        return h.get_num_inside();
+      }, sized_tag("hist::Histogram2D add_samples", N), cfg);
+      
+      hist::Histogram<float> h(100, -4.f, 10.f);
+      for (auto v : values)
+        h += v;
+      // Add a sample per redraw, like a live dashboard, so that the cached view is not just returned.
+      bm.run([&h]()
+      {
+        h += 0.f;
+        return h.to_stringbox(20, 80).size();
+      }, sized_tag("hist::Histogram::to_stringbox", N), cfg);
+      
+      std::vector<int64_t> latencies_ns;
+      latencies_ns.reserve(values.size());
+      for (auto v : values)
+        latencies_ns.emplace_back(static_cast<int64_t>(std::exp(std::abs(v) * 3.f)));
+      bm.run([&latencies_ns]()
+      {
+        hist::HdrHistogram h(1, 3'600'000'000'000, 3);
+        for (auto v : latencies_ns)
+          h += v;
+        return h.get_value_at_percentile(99.9);
+      }, sized_tag("hist::HdrHistogram add", N), cfg);
+      bm.run([&values]()
+      {
+        hist::KllSketch<float> kll;
+        for (auto v : values)
+          kll += v;
+        return kll.get_quantile(0.99);
+      }, sized_tag("hist::KllSketch add", N), cfg);
+      
+      // Four writers feeding one histogram: striped atomics vs. a mutex around Histogram::operator+=.
+      const int num_threads = 4;
+      bm.run([&values, num_threads]()
+      {
+        hist::ConcurrentHistogram<float> h(100, -4.f, 10.f);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+          threads.emplace_back([&h, &values]() { for (auto v : values) h += v; });
+        for (auto& th : threads)
+          th.join();
+        return h.snapshot().get_num_samples();
+      }, sized_tag("hist::ConcurrentHistogram add x4 threads", N), cfg);
+      bm.run([&values, num_threads]()
+      {
+        hist::Histogram<float> h(100, -4.f, 10.f);
+        std::mutex mtx;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+          threads.emplace_back([&h, &mtx, &values]()
+          {
+            for (auto v : values)
+            {
+              std::lock_guard lock(mtx);
+              h += v;
+            }
+          });
+        for (auto& th : threads)
+          th.join();
+        return h.get_num_samples();
+      }, sized_tag("hist::Histogram add x4 threads (mutex)", N), cfg);
+    }
+  }
+  
+  std::vector<std::string> make_word(int num_syllables)
+  {
+    static const std::vector<std::string> syllables { "ka", "ro", "mi", "sen", "tu", "la", "vor", "e", "dra", "quil" };
+    std::vector<std::string> word;
+    for (int s = 0; s < num_syllables; ++s)
+      word.emplace_back(rnd::rand_select(syllables));
+    return word;
+  }
+  
+  void bm_markov_chain(Benchmark& bm)
+  {
+    for (int N : sizes({ 100, 10'000, 100'000 }))
+    {
+      std::vector<std::vector<std::string>> words;
+      for (int w = 0; w < N; ++w)
+        words.emplace_back(make_word(rnd::rand_int(2, 5)));
+      bm.run([&words]()
+      {
+        markov_chain::MarkovChain<std::string> mc("");
+        for (const auto& w : words)
+          mc.add_transitions(w);
+        mc.normalize_transition_weights();
+        return mc.generate();
+      }, sized_tag("markov_chain train", N), sized_config(N * 10));
+      
+      markov_chain::MarkovChain<std::string> mc("");
+      for (const auto& w : words)
+        mc.add_transitions(w);
+      mc.normalize_transition_weights();
+      bm.run([&mc]() { return mc.generate(2, 6); }, sized_tag("markov_chain generate", N), sized_config(N));
+      // 10'000 sequences per call.
+      std::vector<std::string> batch;
+      for (int num_threads : { 1, 4 })
+        bm.run([&mc, &batch, num_threads]()
+        {
+          mc.generate_batch(batch, 10'000, num_threads, 2, 6);
+          return batch.back();
+        }, sized_tag("markov_chain generate_batch x" + std::to_string(num_threads) + " threads", N), sized_config(N));
+      
+      markov_chain::MarkovChain<std::string> mc_3("", 3);
+      for (const auto& w : words)
+        mc_3.add_transitions(w);
+      mc_3.normalize_transition_weights();
+      bm.run([&mc_3]() { return mc_3.generate(2, 6); }, sized_tag("markov_chain generate order 3", N), sized_config(N));
+      
+      // A single start state with N equally likely successors.
+      markov_chain::MarkovChain<std::string> mc_fan("");
+      for (int w = 0; w < N; ++w)
+        mc_fan.add_transition("start", std::to_string(w));
+      mc_fan.normalize_transition_weights();
+      bm.run([&mc_fan]() { return mc_fan.generate(); }, sized_tag("markov_chain generate fan-out", N), sized_config(N));
+    }
+    
+    // Lines of eight words each.
+    auto file_path = (std::filesystem::temp_directory_path() / "core_benchmarks_markov_chain.txt").string();
+    auto snapshot_path = (std::filesystem::temp_directory_path() / "core_benchmarks_markov_chain.bin").string();
+    for (int N : sizes({ 10'000, 200'000 }))
+    {
+      std::vector<std::string> lines;
+      for (int l = 0; l < N; ++l)
+      {
+        std::string line;
+        for (int w = 0; w < 8; ++w)
+        {
+          for (const auto& syllable : make_word(rnd::rand_int(1, 3)))
+            line += syllable;
+          line += ' ';
+        }
+        lines.emplace_back(line);
+      }
+      TextIO::write_file(file_path, lines);
+      for (int num_threads : { 1, 4 })
+        bm.run([&file_path, num_threads]()
+        {
+          markov_chain::MarkovChain<std::string> mc("");
+          mc.import_transitions(file_path, num_threads);
+          return mc.get_num_transitions();
+        }, sized_tag("markov_chain import x" + std::to_string(num_threads) + " threads", N), sized_config(N));
+      
+      markov_chain::MarkovChain<std::string> mc("");
+      mc.import_transitions(file_path);
+      mc.normalize_transition_weights();
+      mc.save_snapshot(snapshot_path);
+      bm.run([&snapshot_path]()
+      {
+        markov_chain::MarkovChain<std::string> mc_snap("");
+        mc_snap.load_snapshot(snapshot_path);
+        return mc_snap.generate();
+      }, sized_tag("markov_chain load snapshot", N), sized_config(N));
+    }
+    std::filesystem::remove(file_path);
+    std::filesystem::remove(snapshot_path);
+  }
+  
+  void bm_textio(Benchmark& bm)
+  {
+    auto file_path = (std::filesystem::temp_directory_path() / "core_benchmarks_textio.txt").string();
+    for (int N : sizes(c_sizes))
+    {
+      std::vector<std::string> lines;
+      for (int l = 0; l < N; ++l)
+        lines.emplace_back("line " + std::to_string(l) + " of the TextIO benchmark input");
+      TextIO::write_file(file_path, lines);
+      bm.run([&file_path]()
+      {
+        std::vector<std::string> read_lines;
+        TextIO::read_file(file_path, read_lines);
+        return read_lines.size();
+      }, sized_tag("TextIO::read_file", N), sized_config(N));
+    }
+    std::filesystem::remove(file_path);
+  }
+
+}
+
+int main(int argc, char** argv)
+{
+  auto print_usage = [&]()
+  {
+    std::cerr << "Usage: " << argv[0] << " [--smoke] [--json <file>] [--csv <file>] [--baseline <file> [--threshold <fraction>]]" << std::endl;
+  };
+  
+  std::string json_path;
+  std::string csv_path;
+  std::string baseline_path;
+  double threshold = 0.1;
+  for (int a_idx = 1; a_idx < argc; ++a_idx)
+  {
+    std::string arg = argv[a_idx];
+    if (arg == "--help" || arg == "-h")
+    {
+      print_usage();
+      return EXIT_SUCCESS;
+    }
+    if (arg == "--smoke")
+    {
+      smoke_run = true;
+      continue;
+    }
+    if (arg != "--json" && arg != "--csv" && arg != "--baseline" && arg != "--threshold")
+    {
+      std::cerr << "Unknown argument \"" << arg << "\"." << std::endl;
+      print_usage();
+      return EXIT_FAILURE;
+    }
+    if (a_idx + 1 == argc)
+    {
+      std::cerr << "Missing value for \"" << arg << "\"." << std::endl;
+      print_usage();
+      return EXIT_FAILURE;
+    }
+    std::string val = argv[++a_idx];
+    if (arg == "--json")
+      json_path = val;
+    else if (arg == "--csv")
+      csv_path = val;
+    else if (arg == "--baseline")
+      baseline_path = val;
+    else
+    {
+      auto [end, ec] = std::from_chars(val.data(), val.data() + val.size(), threshold);
+      if (ec != std::errc {} || end != val.data() + val.size() || !(threshold >= 0.0))
+      {
+        std::cerr << "Invalid threshold \"" << val << "\"." << std::endl;
+        print_usage();
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  
+  rnd::srand(1234);
+  
+  Benchmark bm;
+  bm_rand(bm);
+  bm_math(bm);
+  bm_stlutils(bm);
+  bm_string_helper(bm);
+  bm_datetime(bm);
+  bm_histogram(bm);
+  bm_markov_chain(bm);
+  bm_textio(bm);
+  
+  if (!json_path.empty() && !bm.write_json(json_path))
+    return EXIT_FAILURE;
+  if (!csv_path.empty() && !bm.write_csv(csv_path))
+    return EXIT_FAILURE;
+  if (!baseline_path.empty() && !bm.compare_to_baseline(baseline_path, threshold))
+    return EXIT_FAILURE;
+  
+  return EXIT_SUCCESS;
+}
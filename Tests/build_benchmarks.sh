@@ -0,0 +1,14 @@
+#!/bin/bash
+
+
+additional_flags="-I../.."
+
+../build.sh benchmarks "$1" "${additional_flags[@]}"
+
+# Capture the exit code of Core/build.sh
+exit_code=$?
+
+if [ $exit_code -ne 0 ]; then
+  echo "Core/build.sh failed with exit code $exit_code"
+  exit $exit_code
+fi
@@ -5,8 +5,14 @@
 //  Created by Rasmus Anthin on 2024-09-21.
 //
 
+// Replaces the global operator new/delete (see Benchmark.h) for the whole binary,
+//   so every suite below runs with the allocation counting hooks in place.
+#define BM_TRACK_ALLOCATIONS
 #include "DateTime_tests.h"
 #include "Histogram_tests.h"
+#include "Benchmark_tests.h"
+#include "MarkovChain_tests.h"
+#include "Rand_tests.h"
 #include <iostream>
 
 
@@ -18,5 +24,14 @@ int main(int argc, char** argv)
   std::cout << "### Histogram Tests ###" << std::endl;
   hist::unit_tests();
   
+  std::cout << "### Benchmark Tests ###" << std::endl;
+  benchmark::unit_tests();
+  
+  std::cout << "### MarkovChain Tests ###" << std::endl;
+  markov_chain::unit_tests();
+  
+  std::cout << "### Rand Tests ###" << std::endl;
+  rnd::unit_tests();
+  
   return 0;
 }